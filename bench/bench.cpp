@@ -0,0 +1,778 @@
+// Load generator for the server: keep-alive connections spread over epoll
+// threads, optional pipelining, and either closed-loop (as fast as responses
+// come back) or constant-throughput load. In constant-throughput mode every
+// request has an intended send time on a fixed schedule and its latency is
+// measured from that time, not from when it actually went out, so a stalled
+// server is charged for the requests it held back (coordinated omission).
+//
+// Usage: bench [options] [scenario-file]
+//   -h HOST         default 127.0.0.1
+//   -p PORT         default 3000
+//   -t THREADS      default 1
+//   -c CONNECTIONS  default 64, spread over the threads
+//   -d SECONDS      default 10
+//   -w SECONDS      warmup before measuring, default 1
+//   -D DEPTH        requests in flight per connection, default 1
+//   -R RATE         total requests per second, constant-throughput mode; 0 (default) is closed loop
+//
+// A scenario file has one request per line, "METHOD PATH [BODY]"; blank lines
+// and lines starting with # are skipped. Connections cycle through the lines,
+// repeat a line to weight it. Without a file every request is GET /.
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ctime>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <memory>
+
+static uint64_t now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// ---- Latency histogram, log-linear like the server's metrics but with 32
+// sub-buckets per power of two (under 3% error) and one thread per instance
+
+class Histogram
+{
+public:
+    static const int SUB_BITS = 5;
+    static const int SUB_BUCKETS = 1 << SUB_BITS;
+    static const int MAX_BITS = 40; // ~18 minutes in nanoseconds
+    static const int BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_BUCKETS;
+
+    std::vector<uint64_t> counts = std::vector<uint64_t>(BUCKETS);
+    uint64_t total{0};
+    uint64_t sum{0};
+    uint64_t max{0};
+
+    void record(uint64_t ns)
+    {
+        counts[bucketOf(ns)]++;
+        total++;
+        sum += ns;
+        max = std::max(max, ns);
+    }
+
+    void merge(const Histogram &other)
+    {
+        for (int i = 0; i < BUCKETS; i++)
+        {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+        sum += other.sum;
+        max = std::max(max, other.max);
+    }
+
+    // the upper bound of the bucket the q-th value falls in
+    uint64_t percentile(double q) const
+    {
+        if (total == 0)
+            return 0;
+        uint64_t rank = (uint64_t)std::ceil(q / 100.0 * total);
+        if (rank == 0)
+            rank = 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; i++)
+        {
+            seen += counts[i];
+            if (seen >= rank)
+                return std::min(upperBound(i), max);
+        }
+        return max;
+    }
+
+    static int bucketOf(uint64_t ns)
+    {
+        if (ns < (uint64_t)SUB_BUCKETS)
+            return (int)ns;
+        if (ns >> MAX_BITS)
+            return BUCKETS - 1;
+        int msb = 63 - __builtin_clzll(ns);
+        int shift = msb - SUB_BITS;
+        return (shift + 1) * SUB_BUCKETS + (int)((ns >> shift) & (SUB_BUCKETS - 1));
+    }
+
+    static uint64_t upperBound(int bucket)
+    {
+        if (bucket < SUB_BUCKETS)
+            return bucket;
+        int shift = bucket / SUB_BUCKETS - 1;
+        uint64_t lower = (uint64_t)(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+        return lower + ((uint64_t)1 << shift) - 1;
+    }
+};
+
+// ---- Configuration
+
+struct ScenarioRequest
+{
+    std::string wire; // serialized, ready to send
+    bool head{false}; // the response has no body whatever its headers say
+};
+
+struct Options
+{
+    std::string host{"127.0.0.1"};
+    int port{3000};
+    int threads{1};
+    int connections{64};
+    double duration{10};
+    double warmup{1};
+    int depth{1};
+    double rate{0};
+    std::string scenarioFile;
+};
+
+static std::vector<ScenarioRequest> loadScenario(const Options &options)
+{
+    std::vector<std::string> lines;
+    if (options.scenarioFile.empty())
+        lines.push_back("GET /");
+    else
+    {
+        std::ifstream file(options.scenarioFile);
+        if (!file)
+        {
+            fprintf(stderr, "Cannot read scenario %s\n", options.scenarioFile.c_str());
+            exit(1);
+        }
+        std::string line;
+        while (std::getline(file, line))
+        {
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            if (line.empty() || line[0] == '#')
+                continue;
+            lines.push_back(line);
+        }
+    }
+
+    std::vector<ScenarioRequest> requests;
+    for (const std::string &line : lines)
+    {
+        std::istringstream fields(line);
+        std::string method, path, body;
+        fields >> method >> path;
+        std::getline(fields >> std::ws, body);
+        if (method.empty() || path.empty())
+        {
+            fprintf(stderr, "Bad scenario line: %s\n", line.c_str());
+            exit(1);
+        }
+
+        ScenarioRequest request;
+        request.head = method == "HEAD";
+        request.wire = method + " " + path + " HTTP/1.1\r\nHost: " + options.host + ":" + std::to_string(options.port) +
+                       "\r\nUser-Agent: bench\r\nAccept: */*\r\n";
+        if (!body.empty())
+            request.wire += "Content-Type: application/json\r\nContent-Length: " + std::to_string(body.size()) + "\r\n";
+        request.wire += "\r\n" + body;
+        requests.push_back(std::move(request));
+    }
+    if (requests.empty())
+    {
+        fprintf(stderr, "Scenario %s has no requests\n", options.scenarioFile.c_str());
+        exit(1);
+    }
+    return requests;
+}
+
+// ---- Response framing
+
+enum class Framing
+{
+    INCOMPLETE,
+    COMPLETE,
+    ERROR
+};
+
+struct Response
+{
+    int status{0};
+    bool close{false};
+    size_t length{0}; // bytes of the buffer the response took up
+};
+
+static bool headerIs(const char *line, size_t length, const char *name)
+{
+    size_t n = strlen(name);
+    return length > n && strncasecmp(line, name, n) == 0 && line[n] == ':';
+}
+
+static std::string headerValue(const char *line, size_t length)
+{
+    const char *colon = (const char *)memchr(line, ':', length);
+    size_t start = colon - line + 1;
+    while (start < length && (line[start] == ' ' || line[start] == '\t'))
+        start++;
+    return std::string(line + start, length - start);
+}
+
+// Finds the end of a chunked body starting at position, trailers included
+static Framing chunkedEnd(const std::string &buffer, size_t position, size_t &end)
+{
+    while (true)
+    {
+        size_t lineEnd = buffer.find("\r\n", position);
+        if (lineEnd == std::string::npos)
+            return Framing::INCOMPLETE;
+        char *stop;
+        unsigned long long size = strtoull(buffer.c_str() + position, &stop, 16);
+        if (stop == buffer.c_str() + position)
+            return Framing::ERROR;
+        position = lineEnd + 2;
+
+        if (size == 0)
+        {
+            // trailers, then an empty line
+            while (true)
+            {
+                lineEnd = buffer.find("\r\n", position);
+                if (lineEnd == std::string::npos)
+                    return Framing::INCOMPLETE;
+                bool empty = lineEnd == position;
+                position = lineEnd + 2;
+                if (empty)
+                {
+                    end = position;
+                    return Framing::COMPLETE;
+                }
+            }
+        }
+        if (buffer.size() < position + size + 2)
+            return Framing::INCOMPLETE;
+        position += size + 2;
+    }
+}
+
+// Frames the response starting at from, a pipelined batch is walked without copying
+static Framing frame(const std::string &buffer, size_t from, bool head, Response &response)
+{
+    size_t headEnd = buffer.find("\r\n\r\n", from);
+    if (headEnd == std::string::npos)
+        return buffer.size() - from > 65536 ? Framing::ERROR : Framing::INCOMPLETE;
+
+    if (buffer.compare(from, 5, "HTTP/") != 0 || headEnd < from + 12)
+        return Framing::ERROR;
+    response.status = atoi(buffer.c_str() + from + 9);
+
+    bool http10 = buffer.compare(from, 8, "HTTP/1.0") == 0;
+    bool chunked = false;
+    bool hasLength = false;
+    size_t contentLength = 0;
+    response.close = http10;
+
+    size_t position = buffer.find("\r\n", from) + 2;
+    while (position < headEnd)
+    {
+        size_t lineEnd = buffer.find("\r\n", position);
+        const char *line = buffer.c_str() + position;
+        size_t length = lineEnd - position;
+        if (headerIs(line, length, "Content-Length"))
+        {
+            contentLength = strtoull(headerValue(line, length).c_str(), nullptr, 10);
+            hasLength = true;
+        }
+        else if (headerIs(line, length, "Transfer-Encoding"))
+            chunked = strcasestr(headerValue(line, length).c_str(), "chunked") != nullptr;
+        else if (headerIs(line, length, "Connection"))
+        {
+            std::string value = headerValue(line, length);
+            if (strcasestr(value.c_str(), "close"))
+                response.close = true;
+            else if (strcasestr(value.c_str(), "keep-alive"))
+                response.close = false;
+        }
+        position = lineEnd + 2;
+    }
+
+    size_t bodyStart = headEnd + 4;
+    bool noBody = head || response.status == 204 || response.status == 304 || response.status / 100 == 1;
+    size_t end = bodyStart;
+    Framing framing = Framing::COMPLETE;
+    if (chunked && !noBody)
+        framing = chunkedEnd(buffer, bodyStart, end);
+    else if (hasLength && !noBody)
+    {
+        end = bodyStart + contentLength;
+        if (buffer.size() < end)
+            framing = Framing::INCOMPLETE;
+    }
+    else if (!noBody)
+        return Framing::ERROR; // delimited by the close, nothing we send gets such a response
+    response.length = end - from;
+    return framing;
+}
+
+// ---- Worker
+
+struct InFlight
+{
+    uint64_t start; // intended send time in constant-throughput mode, else the actual one
+    size_t request;
+};
+
+struct Connection
+{
+    int fd{-1};
+    bool connecting{false};
+    std::string out;
+    size_t outOffset{0};
+    std::string in;
+    std::deque<InFlight> inFlight; // sent, waiting for their responses in order
+    std::deque<InFlight> retry;    // in flight when the connection closed, resent first
+    uint64_t nextSend{0};          // constant-throughput mode: intended time of the next request
+    size_t nextRequest{0};
+};
+
+struct Stats
+{
+    Histogram latency;
+    uint64_t statusClasses[6]{}; // [1..5]xx, [0] anything else
+    uint64_t bytes{0};
+    uint64_t connectErrors{0};
+    uint64_t readErrors{0};
+    uint64_t reconnects{0};
+};
+
+class Worker
+{
+public:
+    Worker(const Options &options, const sockaddr_in &address, const std::vector<ScenarioRequest> &scenario,
+           int connections, int firstConnection)
+        : options(options), address(address), scenario(scenario), connections(connections)
+    {
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+        // epoll_wait only takes milliseconds, a late wakeup would be charged to the server
+        timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.u32 = TIMER;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, timerfd, &ev);
+        // per connection rate, and an offset that spreads the connections over one interval
+        if (options.rate > 0)
+            interval = (uint64_t)(1e9 * options.connections / options.rate);
+        for (int i = 0; i < connections; i++)
+        {
+            conns[i].nextRequest = (size_t)(firstConnection + i) % scenario.size();
+            conns[i].nextSend = interval * (uint64_t)(firstConnection + i) / options.connections;
+        }
+    }
+
+    ~Worker()
+    {
+        for (Connection &conn : conns)
+        {
+            if (conn.fd >= 0)
+                close(conn.fd);
+        }
+        close(timerfd);
+        close(epfd);
+    }
+
+    Stats stats;
+
+    void run(uint64_t startAt)
+    {
+        start = startAt;
+        measureFrom = start + (uint64_t)(options.warmup * 1e9);
+        end = measureFrom + (uint64_t)(options.duration * 1e9);
+        for (Connection &conn : conns)
+        {
+            conn.nextSend += start;
+        }
+        for (int i = 0; i < connections; i++)
+        {
+            connect(i);
+        }
+
+        epoll_event events[256];
+        while (true)
+        {
+            uint64_t t = now();
+            if (t >= end)
+                break;
+
+            int n = epoll_wait(epfd, events, 256, timeoutMs(t));
+            for (int e = 0; e < n; e++)
+            {
+                if (events[e].data.u32 == TIMER)
+                {
+                    uint64_t expirations;
+                    ssize_t ignored = read(timerfd, &expirations, sizeof(expirations));
+                    (void)ignored;
+                    continue;
+                }
+                int index = (int)events[e].data.u32;
+                Connection &conn = conns[index];
+                if (conn.connecting)
+                {
+                    int error = 0;
+                    socklen_t length = sizeof(error);
+                    getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+                    if (error)
+                    {
+                        stats.connectErrors++;
+                        reconnect(index);
+                        continue;
+                    }
+                    conn.connecting = false;
+                }
+                if (events[e].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                {
+                    if (!readable(index))
+                        continue;
+                }
+                if (events[e].events & EPOLLOUT)
+                    flush(index);
+            }
+
+            // queue whatever is due on every connection
+            t = now();
+            for (int i = 0; i < connections; i++)
+            {
+                if (conns[i].fd >= 0 && !conns[i].connecting)
+                    send(i, t);
+            }
+        }
+    }
+
+private:
+    const Options &options;
+    sockaddr_in address;
+    const std::vector<ScenarioRequest> &scenario;
+    int connections;
+    std::vector<Connection> conns = std::vector<Connection>(connections);
+    static const uint32_t TIMER = UINT32_MAX; // epoll data of the timerfd, connections use their index
+    int epfd{-1};
+    int timerfd{-1};
+    uint64_t interval{0};
+    uint64_t start{0};
+    uint64_t measureFrom{0};
+    uint64_t end{0};
+
+    // Arms the timerfd for the next request due, the epoll_wait timeout only
+    // bounds how late the end of the run is noticed
+    int timeoutMs(uint64_t t)
+    {
+        uint64_t until = end;
+        if (interval)
+        {
+            for (const Connection &conn : conns)
+            {
+                if (conn.fd >= 0 && !conn.connecting && (int)conn.inFlight.size() < options.depth)
+                    until = std::min(until, conn.nextSend);
+            }
+        }
+        if (until <= t)
+            return 0;
+        if (interval)
+        {
+            itimerspec timer{};
+            timer.it_value.tv_sec = until / 1000000000;
+            timer.it_value.tv_nsec = until % 1000000000;
+            timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &timer, nullptr);
+        }
+        return (int)std::min<uint64_t>((end - t + 999999) / 1000000, 100);
+    }
+
+    void connect(int index)
+    {
+        Connection &conn = conns[index];
+        conn.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int one = 1;
+        setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        conn.connecting = true;
+        if (::connect(conn.fd, (const sockaddr *)&address, sizeof(address)) < 0 && errno != EINPROGRESS)
+        {
+            stats.connectErrors++;
+            close(conn.fd);
+            conn.fd = -1;
+            return;
+        }
+
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.u32 = index;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, conn.fd, &ev);
+    }
+
+    // Requests that never got a response go out again on the new connection,
+    // still timed from when they were first due
+    void reconnect(int index)
+    {
+        Connection &conn = conns[index];
+        close(conn.fd);
+        conn.fd = -1;
+        conn.connecting = false;
+        conn.out.clear();
+        conn.outOffset = 0;
+        conn.in.clear();
+        conn.retry.insert(conn.retry.end(), conn.inFlight.begin(), conn.inFlight.end());
+        conn.inFlight.clear();
+        stats.reconnects++;
+        connect(index);
+    }
+
+    void send(int index, uint64_t t)
+    {
+        Connection &conn = conns[index];
+        bool queued = false;
+        while ((int)conn.inFlight.size() < options.depth)
+        {
+            InFlight request;
+            if (!conn.retry.empty())
+            {
+                request = conn.retry.front();
+                conn.retry.pop_front();
+            }
+            else
+            {
+                if (interval)
+                {
+                    if (conn.nextSend > t)
+                        break;
+                    request.start = conn.nextSend;
+                    conn.nextSend += interval;
+                }
+                else
+                    request.start = t;
+                request.request = conn.nextRequest;
+                conn.nextRequest = (conn.nextRequest + 1) % scenario.size();
+            }
+            conn.out += scenario[request.request].wire;
+            conn.inFlight.push_back(request);
+            queued = true;
+        }
+        if (queued)
+            flush(index);
+    }
+
+    void flush(int index)
+    {
+        Connection &conn = conns[index];
+        while (conn.outOffset < conn.out.size())
+        {
+            ssize_t written = ::send(conn.fd, conn.out.data() + conn.outOffset, conn.out.size() - conn.outOffset, MSG_NOSIGNAL);
+            if (written > 0)
+            {
+                conn.outOffset += written;
+                continue;
+            }
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return; // EPOLLOUT resumes us
+            stats.readErrors++;
+            reconnect(index);
+            return;
+        }
+        conn.out.clear();
+        conn.outOffset = 0;
+    }
+
+    // false when the connection was replaced
+    bool readable(int index)
+    {
+        Connection &conn = conns[index];
+        char buffer[65536];
+        bool closed = false;
+        while (true)
+        {
+            ssize_t bytes = recv(conn.fd, buffer, sizeof(buffer), 0);
+            if (bytes > 0)
+            {
+                conn.in.append(buffer, bytes);
+                continue;
+            }
+            if (bytes == 0)
+                closed = true;
+            else if (errno == EINTR)
+                continue;
+            else if (errno != EAGAIN && errno != EWOULDBLOCK)
+                closed = true;
+            break;
+        }
+
+        uint64_t t = now();
+        size_t consumed = 0;
+        while (!conn.inFlight.empty())
+        {
+            Response response;
+            Framing framing = frame(conn.in, consumed, scenario[conn.inFlight.front().request].head, response);
+            if (framing == Framing::INCOMPLETE)
+                break;
+            if (framing == Framing::ERROR)
+            {
+                stats.readErrors++;
+                conn.inFlight.clear(); // unparseable, nothing after it can be trusted
+                reconnect(index);
+                return false;
+            }
+
+            InFlight done = conn.inFlight.front();
+            conn.inFlight.pop_front();
+            consumed += response.length;
+            if (t >= measureFrom && done.start >= measureFrom)
+            {
+                stats.latency.record(t - done.start);
+                int statusClass = response.status / 100;
+                stats.statusClasses[statusClass >= 1 && statusClass <= 5 ? statusClass : 0]++;
+                stats.bytes += response.length;
+            }
+            if (response.close)
+            {
+                closed = true;
+                break;
+            }
+        }
+        conn.in.erase(0, consumed);
+
+        if (closed)
+        {
+            // requests still in flight are resent, a response cut short is an error
+            if (!conn.in.empty())
+                stats.readErrors++;
+            reconnect(index);
+            return false;
+        }
+        return true;
+    }
+};
+
+// ---- Main
+
+static void usage()
+{
+    fprintf(stderr, "usage: bench [-h host] [-p port] [-t threads] [-c connections] [-d seconds] [-w seconds]\n"
+                    "             [-D pipeline depth] [-R total req/s, 0 = closed loop] [scenario-file]\n");
+    exit(1);
+}
+
+static std::string millis(uint64_t ns)
+{
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.3fms", ns / 1e6);
+    return buffer;
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:t:c:d:w:D:R:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'h': options.host = optarg; break;
+        case 'p': options.port = atoi(optarg); break;
+        case 't': options.threads = atoi(optarg); break;
+        case 'c': options.connections = atoi(optarg); break;
+        case 'd': options.duration = atof(optarg); break;
+        case 'w': options.warmup = atof(optarg); break;
+        case 'D': options.depth = atoi(optarg); break;
+        case 'R': options.rate = atof(optarg); break;
+        default: usage();
+        }
+    }
+    if (optind < argc)
+        options.scenarioFile = argv[optind];
+    if (options.threads < 1 || options.connections < options.threads || options.depth < 1 || options.duration <= 0)
+        usage();
+
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *resolved;
+    if (getaddrinfo(options.host.c_str(), nullptr, &hints, &resolved) != 0)
+    {
+        fprintf(stderr, "Cannot resolve %s\n", options.host.c_str());
+        return 1;
+    }
+    sockaddr_in address = *(sockaddr_in *)resolved->ai_addr;
+    address.sin_port = htons(options.port);
+    freeaddrinfo(resolved);
+
+    std::vector<ScenarioRequest> scenario = loadScenario(options);
+
+    printf("Running %.0fs test @ %s:%d, %s\n", options.duration, options.host.c_str(), options.port,
+           options.scenarioFile.empty() ? "GET /" : options.scenarioFile.c_str());
+    printf("  %d threads, %d connections, pipeline depth %d, ", options.threads, options.connections, options.depth);
+    if (options.rate > 0)
+        printf("constant %.0f req/s, latency from intended send time\n", options.rate);
+    else
+        printf("closed loop\n");
+    fflush(stdout);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    int first = 0;
+    for (int i = 0; i < options.threads; i++)
+    {
+        int count = options.connections / options.threads + (i < options.connections % options.threads ? 1 : 0);
+        workers.push_back(std::make_unique<Worker>(options, address, scenario, count, first));
+        first += count;
+    }
+
+    uint64_t start = now();
+    std::vector<std::thread> threads;
+    for (auto &worker : workers)
+    {
+        threads.emplace_back(&Worker::run, worker.get(), start);
+    }
+    for (std::thread &t : threads)
+    {
+        t.join();
+    }
+
+    Stats total;
+    for (auto &worker : workers)
+    {
+        total.latency.merge(worker->stats.latency);
+        for (int c = 0; c < 6; c++)
+        {
+            total.statusClasses[c] += worker->stats.statusClasses[c];
+        }
+        total.bytes += worker->stats.bytes;
+        total.connectErrors += worker->stats.connectErrors;
+        total.readErrors += worker->stats.readErrors;
+        total.reconnects += worker->stats.reconnects;
+    }
+
+    const Histogram &latency = total.latency;
+    printf("Requests: %llu in %.2fs, %.1f req/s, %.2f MB/s\n", (unsigned long long)latency.total, options.duration,
+           latency.total / options.duration, total.bytes / options.duration / 1e6);
+    printf("Status: 2xx %llu, 3xx %llu, 4xx %llu, 5xx %llu, other %llu\n",
+           (unsigned long long)total.statusClasses[2], (unsigned long long)total.statusClasses[3],
+           (unsigned long long)total.statusClasses[4], (unsigned long long)total.statusClasses[5],
+           (unsigned long long)(total.statusClasses[0] + total.statusClasses[1]));
+    printf("Errors: connect %llu, read %llu, reconnects %llu\n", (unsigned long long)total.connectErrors,
+           (unsigned long long)total.readErrors, (unsigned long long)total.reconnects);
+    printf("Latency: mean %s, p50 %s, p90 %s, p99 %s, p99.9 %s, max %s\n",
+           millis(latency.total ? latency.sum / latency.total : 0).c_str(), millis(latency.percentile(50)).c_str(),
+           millis(latency.percentile(90)).c_str(), millis(latency.percentile(99)).c_str(),
+           millis(latency.percentile(99.9)).c_str(), millis(latency.max).c_str());
+    return total.connectErrors + total.readErrors > 0 && latency.total == 0 ? 1 : 0;
+}
@@ -0,0 +1,429 @@
+// Microbenchmarks of the request path pieces in isolation: parsing, building
+// the Request, route matching, the stock middlewares, response serialization,
+// content type lookup and the caller side of logging. Every case runs on
+// realistic inputs, is calibrated to run for a while and repeated, and
+// reports the median time per operation together with the heap allocations
+// and bytes it asked for per operation.
+//
+// Usage: microbench [filter]
+//   only the cases whose name contains filter run
+//
+// Allocations are counted by replacing the global operator new, so memory a
+// C library mallocs directly is not included. Allocations served by the
+// request arena are not heap allocations and are not counted either, only
+// what spills past it.
+
+#include "parser.hpp"
+#include "request.hpp"
+#include "response.hpp"
+#include "router.hpp"
+#include "arena.hpp"
+#include "middlewares.hpp"
+#include "logger.hpp"
+#include <ctime>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <new>
+#include <map>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <streambuf>
+
+// ---- Allocation counting
+
+namespace
+{
+    struct AllocationCounters
+    {
+        uint64_t allocations;
+        uint64_t bytes;
+    };
+}
+
+// per thread, so the logger's writer thread never shows up in a case
+static thread_local AllocationCounters counters{0, 0};
+
+static void *allocate(size_t size)
+{
+    counters.allocations++;
+    counters.bytes += size;
+    void *p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+static void *allocateAligned(size_t size, std::align_val_t alignment)
+{
+    counters.allocations++;
+    counters.bytes += size;
+    size_t align = std::max((size_t)alignment, sizeof(void *));
+    void *p = aligned_alloc(align, (size + align - 1) / align * align);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void *operator new(size_t size) { return allocate(size); }
+void *operator new[](size_t size) { return allocate(size); }
+void *operator new(size_t size, std::align_val_t alignment) { return allocateAligned(size, alignment); }
+void *operator new[](size_t size, std::align_val_t alignment) { return allocateAligned(size, alignment); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { free(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept { free(p); }
+void operator delete[](void *p, size_t, std::align_val_t) noexcept { free(p); }
+
+// ---- Harness
+
+static uint64_t now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// keeps the compiler from dropping a computation whose result is unused
+template <typename T>
+static void keep(const T &value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+static const uint64_t CALIBRATE_NS = 10000000; // a run this long is enough to size the real ones
+static const uint64_t RUN_NS = 100000000;      // length of each measured run
+static const int REPEATS = 5;                  // measured runs, the median is reported
+
+static const char *filter = nullptr;
+
+namespace
+{
+    struct Run
+    {
+        uint64_t ns;
+        uint64_t allocations;
+        uint64_t bytes;
+    };
+
+    // Optional pause between batches of a case, outside the timing and the
+    // allocation counts. batch == 0 runs every iteration in one go.
+    struct Pacing
+    {
+        size_t batch{0};
+        std::function<void()> settle;
+    };
+}
+
+template <typename Op>
+static Run run(Op &op, size_t iterations, const Pacing &pacing)
+{
+    Run result{0, 0, 0};
+    size_t batch = pacing.batch ? pacing.batch : iterations;
+    for (size_t done = 0; done < iterations;)
+    {
+        size_t n = std::min(batch, iterations - done);
+        AllocationCounters before = counters;
+        uint64_t start = now();
+        for (size_t i = 0; i < n; i++)
+        {
+            op();
+        }
+        result.ns += now() - start;
+        result.allocations += counters.allocations - before.allocations;
+        result.bytes += counters.bytes - before.bytes;
+        done += n;
+
+        if (pacing.settle)
+            pacing.settle();
+    }
+    return result;
+}
+
+template <typename Op>
+static void measure(const char *name, Op op, const Pacing &pacing = Pacing())
+{
+    if (filter && !strstr(name, filter))
+        return;
+
+    // grow until a run takes long enough to extrapolate from
+    size_t iterations = 1;
+    Run probe = run(op, iterations, pacing);
+    while (probe.ns < CALIBRATE_NS && iterations < ((size_t)1 << 32))
+    {
+        iterations *= 10;
+        probe = run(op, iterations, pacing);
+    }
+    iterations = std::max<size_t>(1, (size_t)((double)iterations * RUN_NS / std::max<uint64_t>(probe.ns, 1)));
+
+    std::vector<Run> runs;
+    for (int r = 0; r < REPEATS; r++)
+    {
+        runs.push_back(run(op, iterations, pacing));
+    }
+    std::sort(runs.begin(), runs.end(), [](const Run &a, const Run &b)
+              { return a.ns < b.ns; });
+    const Run &median = runs[REPEATS / 2];
+
+    printf("%-32s %12.1f %12.2f %12.1f\n", name, (double)median.ns / iterations,
+           (double)median.allocations / iterations, (double)median.bytes / iterations);
+    fflush(stdout);
+}
+
+// ---- Inputs
+
+static const std::string BROWSER_GET =
+    "GET /shop/electronics/product/usb-c-cable HTTP/1.1\r\n"
+    "Host: localhost:3000\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/126.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Accept-Language: en-US,en;q=0.9\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Cookie: session=3f9a1c27b4e8d605; theme=dark; consent=1\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n";
+
+static const std::string QUERY_GET =
+    "GET /search/caf%C3%A9+cr%C3%A8me?q=hello+world&page=2&sort=price%20asc&tag=new&tag=sale HTTP/1.1\r\n"
+    "Host: localhost:3000\r\n"
+    "User-Agent: curl/8.5.0\r\n"
+    "Accept: */*\r\n"
+    "\r\n";
+
+static const std::string JSON_BODY =
+    "{\"user\":{\"id\":4182,\"name\":\"Ada Lovelace\",\"email\":\"ada@example.com\"},"
+    "\"items\":[{\"sku\":\"USB-C-1M\",\"qty\":2,\"price\":9.99},{\"sku\":\"HDMI-2M\",\"qty\":1,\"price\":14.5}],"
+    "\"coupon\":null,\"gift\":false}";
+
+static const std::string JSON_POST =
+    "POST /index HTTP/1.1\r\n"
+    "Host: localhost:3000\r\n"
+    "User-Agent: curl/8.5.0\r\n"
+    "Accept: */*\r\n"
+    "Content-Type: application/json\r\n"
+    "Content-Length: " + std::to_string(JSON_BODY.size()) + "\r\n"
+    "\r\n" + JSON_BODY;
+
+static void parseOnce(RequestParser &parser, const std::string &raw)
+{
+    parser.reset();
+    if (parser.parse(raw.data(), raw.size()) != ParseResult::COMPLETE)
+    {
+        fprintf(stderr, "Benchmark input does not parse:\n%s\n", raw.c_str());
+        exit(1);
+    }
+}
+
+// the routes of main.cpp plus what Server registers by itself, compiled the
+// way Server::compileRoutes does it
+static void buildRouter(Router &router)
+{
+    std::map<std::pair<std::string, std::string>, Handler> pathMap;
+    Handler handler = [](Request &, Response &) {};
+    const char *files[] = {"404.html", "about.html", "about.txt", "android-chrome-192x192.png",
+                           "android-chrome-512x512.png", "apple-touch-icon.png", "contact.html",
+                           "favicon-16x16.png", "favicon-32x32.png", "favicon.ico", "index.html",
+                           "projects.html", "site.webmanifest", "style.css", "test-cors.html"};
+    for (const char *file : files)
+    {
+        pathMap[{std::string("/public/") + file, "GET"}] = handler;
+    }
+    pathMap[{"/index", "GET"}] = handler;
+    pathMap[{"/index", "POST"}] = handler;
+    pathMap[{"/index/:userId/:courseId", "GET"}] = handler;
+    pathMap[{"/usr/:userId/:courseId/:thi", "GET"}] = handler;
+    pathMap[{"/api/:version/org/:orgName/team/:teamName", "GET"}] = handler;
+    pathMap[{"/shop/:category/product/:productName", "GET"}] = handler;
+    pathMap[{"/metrics", "GET"}] = handler;
+
+    for (auto &it : pathMap)
+    {
+        router.add(it.first.second, it.first.first, it.second);
+    }
+}
+
+// swallows the log lines while the logger cases run
+class NullBuffer : public std::streambuf
+{
+protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char *, std::streamsize n) override { return n; }
+};
+
+// ---- Cases
+
+int main(int argc, char **argv)
+{
+    if (argc > 2 || (argc == 2 && argv[1][0] == '-'))
+    {
+        fprintf(stderr, "Usage: %s [filter]\n", argv[0]);
+        return 1;
+    }
+    if (argc == 2)
+        filter = argv[1];
+
+    printf("%-32s %12s %12s %12s\n", "case", "ns/op", "allocs/op", "bytes/op");
+
+    RequestArena arena;
+
+    // -- Parsing
+    {
+        RequestParser parser;
+        measure("parse/browser-get", [&]
+                { parser.reset(); keep(parser.parse(BROWSER_GET.data(), BROWSER_GET.size())); });
+        measure("parse/json-post", [&]
+                { parser.reset(); keep(parser.parse(JSON_POST.data(), JSON_POST.size())); });
+    }
+
+    // -- Building the Request from a parsed one, copied into the arena or as views
+    {
+        RequestParser browser;
+        RequestParser post;
+        parseOnce(browser, BROWSER_GET);
+        parseOnce(post, JSON_POST);
+
+        auto build = [&](const RequestParser &parser, const std::string &raw, bool zeroCopy)
+        {
+            return [&parser, &raw, &arena, zeroCopy]
+            {
+                {
+                    Request request(-1, parser, raw.data(), arena.get(), zeroCopy);
+                    keep(request.path().size());
+                }
+                arena.reset();
+            };
+        };
+        measure("request/browser-get-copy", build(browser, BROWSER_GET, false));
+        measure("request/browser-get-view", build(browser, BROWSER_GET, true));
+        measure("request/json-post-copy", build(post, JSON_POST, false));
+        measure("request/json-post-view", build(post, JSON_POST, true));
+    }
+
+    // -- Route matching
+    {
+        Router router;
+        buildRouter(router);
+        auto lookup = [&](const char *method, const char *path)
+        {
+            return [&router, method, path]
+            {
+                RouteMatch match;
+                keep(router.match(method, path, match));
+                keep(match.route);
+            };
+        };
+        measure("route/static", lookup("GET", "/public/style.css"));
+        measure("route/params-2", lookup("GET", "/shop/electronics/product/usb-c-cable"));
+        measure("route/params-3", lookup("GET", "/api/v2/org/acme/team/platform"));
+        measure("route/miss", lookup("GET", "/public/missing/deeper/path.js"));
+    }
+
+    // -- Middlewares, each on a freshly built copied Request the way the server
+    // runs them; the none-* cases are the cost of that setup alone
+    {
+        RequestParser browser;
+        RequestParser query;
+        RequestParser post;
+        parseOnce(browser, BROWSER_GET);
+        parseOnce(query, QUERY_GET);
+        parseOnce(post, JSON_POST);
+        Next next = [] {};
+        OutputQueue output; // never flushed, the middlewares under test do not send
+
+        auto chain = [&](const RequestParser &parser, const std::string &raw, Middleware middleware)
+        {
+            return [&parser, &raw, &arena, &next, &output, middleware]
+            {
+                {
+                    Request request(-1, parser, raw.data(), arena.get());
+                    Response response(-1, output, arena.get());
+                    middleware(request, response, next);
+                    keep(request.data.path.size());
+                }
+                arena.reset();
+            };
+        };
+        Middleware none = [](Request &, Response &, Next next)
+        { next(); };
+        measure("middleware/none-query", chain(query, QUERY_GET, none));
+        measure("middleware/urlDecode", chain(query, QUERY_GET, urlDecode));
+        measure("middleware/paramExtractor", chain(query, QUERY_GET, paramExtractor));
+        measure("middleware/none-browser", chain(browser, BROWSER_GET, none));
+        measure("middleware/parseJson-skip", chain(browser, BROWSER_GET, parseJson));
+        measure("middleware/none-json", chain(post, JSON_POST, none));
+        measure("middleware/parseJson", chain(post, JSON_POST, parseJson));
+    }
+
+    // -- Response serialization and content types
+    {
+        OutputQueue output;
+        Response response(-1, output, arena.get());
+        response.status = Response::statusLine(200);
+        response.setHTTPHeader("Access-Control-Allow-Origin", "*");
+        response.setHTTPHeader("Access-Control-Allow-Methods", "GET, POST, PUT, PATCH");
+        response.setHTTPHeader("Access-Control-Allow-Headers", "Content-Type, Authorization");
+        response.setHTTPHeader("Content-Type", "text/html");
+        response.setHTTPHeader("Set-Cookie", "testCookie=testData; Domain=localhost.com; Path=/index; Max-Age=3000; HttpOnly; SameSite=Lax");
+        response.setHTTPHeader("Connection", "keep-alive");
+        response.body = "<!DOCTYPE html><html><head><title>Shop</title></head><body>";
+        for (int i = 0; i < 16; i++)
+        {
+            response.body += "<li><a href=\"/shop/electronics/product/item-" + std::to_string(i) + "\">Item</a></li>";
+        }
+        response.body += "</body></html>";
+        response.setHTTPHeader("Content-Length", std::to_string(response.body.size()));
+
+        measure("response/prepareRequest", [&]
+                { keep(response.prepareRequest()); });
+
+        const std::string files[] = {"public/index.html", "public/style.css", "public/favicon-32x32.png",
+                                     "public/site.webmanifest"};
+        size_t next = 0;
+        measure("response/getContentType", [&]
+                { keep(response.getContentType(files[next++ & 3])); });
+    }
+    arena.reset();
+
+    // -- Logging, what the calling thread pays. Batches stay under the queue
+    // capacity and the writer catches up between them, so nothing is dropped.
+    {
+        NullBuffer null;
+        std::streambuf *console = std::cout.rdbuf(&null);
+
+        Pacing pacing;
+        pacing.batch = LoggerConfig().queueCapacity / 2;
+        pacing.settle = []
+        {
+            for (LoggerStats stats = logger.stats(); stats.written < stats.logged; stats = logger.stats())
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+        };
+        pacing.settle();
+
+        const std::string message = "Inherited 2 listening sockets from the process being replaced";
+        measure("logger/request", [&]
+                { logger.request("GET", "/shop/electronics/product/usb-c-cable", "200 OK"); }, pacing);
+        measure("logger/info", [&]
+                { logger.info(message); }, pacing);
+        measure("logger/debug-filtered", [&]
+                { logger.debug(message); }, pacing);
+
+        pacing.settle();
+        std::cout.rdbuf(console);
+    }
+
+    return 0;
+}
@@ -0,0 +1,65 @@
+#!/bin/bash
+# Runs the same load against the epoll and io_uring backends, one after the other,
+# with the same binary, routes, thread count and client settings.
+#
+# Usage: ./bench_backends.sh [build_dir]
+# Uses the bench load generator built next to the server (cmake --build builds both).
+
+# Configuration
+BUILD_DIR=${1:-./build}
+SERVER_BIN=$BUILD_DIR/server
+BENCH_BIN=$BUILD_DIR/bench
+PORT=3000
+CONNECTIONS=${CONNECTIONS:-100}
+THREADS=${THREADS:-2}
+DURATION=${DURATION:-10}
+DEPTH=${DEPTH:-1}
+RATE=${RATE:-0} # total req/s for a constant-throughput run, 0 is closed loop
+BACKENDS=("epoll" "io_uring")
+SCENARIOS=(
+    "bench/scenarios/dynamic.txt"
+    "bench/scenarios/assets.txt"
+)
+
+# Colors for output
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+BLUE='\033[0;34m'
+RED='\033[0;31m'
+NC='\033[0m' # No Color
+
+for bin in "$SERVER_BIN" "$BENCH_BIN"; do
+    if [[ ! -x $bin ]]; then
+        echo -e "${RED}Binary not found: ${bin}${NC}"
+        exit 1
+    fi
+done
+
+run_backend() {
+    local backend=$1
+
+    $SERVER_BIN --backend=$backend > /dev/null 2>&1 &
+    local pid=$!
+    sleep 1
+
+    echo -e "${BLUE}=== Backend: ${backend} ===${NC}"
+    for scenario in "${SCENARIOS[@]}"; do
+        local out=$($BENCH_BIN -p $PORT -t $THREADS -c $CONNECTIONS -d $DURATION -D $DEPTH -R $RATE "$scenario" 2>&1)
+        local rps=$(echo "$out" | awk '/^Requests:/ {print $5}')
+        local latency=$(echo "$out" | sed -n 's/^Latency: //p')
+        local errors=$(echo "$out" | sed -n 's/^Errors: //p')
+
+        echo -e "  ${YELLOW}${scenario}${NC}"
+        echo -e "    Throughput: ${GREEN}${rps} req/sec${NC}"
+        echo -e "    ${latency}"
+        echo -e "    Errors: ${errors}"
+    done
+    echo ""
+
+    kill $pid
+    wait $pid 2> /dev/null
+}
+
+for backend in "${BACKENDS[@]}"; do
+    run_backend $backend
+done
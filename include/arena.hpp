@@ -0,0 +1,24 @@
+#pragma once
+#include <cstddef>
+#include <memory_resource>
+
+// Bump allocator for everything a single request allocates: the Request
+// fields, the Response headers and the containers behind them. Nothing is
+// freed individually, reset() throws the whole request away at once and
+// rewinds to the inline buffer, so a typical request never reaches malloc.
+class RequestArena
+{
+public:
+    static const size_t INLINE_SIZE = 16384;
+
+    RequestArena() : resource(buffer, sizeof(buffer)) {}
+    RequestArena(const RequestArena &) = delete;
+    RequestArena &operator=(const RequestArena &) = delete;
+
+    std::pmr::memory_resource *get() { return &resource; }
+    void reset() { resource.release(); }
+
+private:
+    alignas(std::max_align_t) char buffer[INLINE_SIZE];
+    std::pmr::monotonic_buffer_resource resource; // spills to new/delete past the inline buffer
+};
@@ -0,0 +1,67 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <ctime>
+#include <sys/stat.h>
+#include "compression.hpp"
+
+// One encoding of a static file with its 200 response head already serialized.
+// The bytes are in body, or, for files too large for the memory cache, in an
+// anonymous memfd that goes out through sendfile(2)/splice like a file on disk.
+struct CachedAsset
+{
+    std::string head; // status line, content and validator headers, no terminating CRLF
+    std::string body;
+    int fd{-1};     // owned by the cache, responses send from a dup of it
+    size_t size{0}; // bytes in body or in the memfd
+    std::string contentType;
+    Encoding encoding{Encoding::IDENTITY};
+    std::string etag;         // strong, quoted, differs per encoding
+    std::string lastModified; // HTTP-date of the file's mtime
+    time_t modified{0};
+};
+
+// All stored encodings of one file. The identity one is missing for files only
+// the sendfile path serves, the compressed ones for files that don't shrink.
+struct AssetEntry
+{
+    CachedAsset variants[(int)Encoding::COUNT];
+    unsigned stored{0}; // bit 1 << Encoding per variant present
+
+    bool varies() const { return stored & ~(1u << (int)Encoding::IDENTITY); }
+};
+
+// Small files under a directory are loaded once at startup, and gzip/Brotli
+// variants are made for the text files. The cache is read-only after that,
+// so every loop thread serves from it without locking. Files over the size
+// threshold, or past the memory budget, are left to the sendfile path.
+class AssetCache
+{
+public:
+    size_t bytesUsed{0};       // identity bodies held in memory
+    size_t compressedBytes{0}; // compressed variants, in memory and in memfds
+
+    AssetCache() = default;
+    AssetCache(const AssetCache &) = delete;
+    AssetCache &operator=(const AssetCache &) = delete;
+    ~AssetCache();
+
+    void load(const std::string &directory, size_t budget, size_t maxFileSize);
+    // compresses the text files up to maxFileSize, the variants may take up to budget bytes
+    void compress(const std::string &directory, size_t budget, size_t maxFileSize);
+
+    // Best stored variant the client accepts. Returns nullptr when the file has
+    // to be read from disk. vary is set when the choice depends on Accept-Encoding.
+    const CachedAsset *select(const std::string &filepath, std::string_view acceptEncoding, bool &vary) const;
+
+    // strong validator from inode, size and mtime, so it is computed without reading the file
+    static std::string entityTag(const struct stat &st, Encoding encoding);
+    // IMF-fixdate, "Sun, 06 Nov 1994 08:49:37 GMT"
+    static std::string httpDate(time_t time);
+
+private:
+    std::unordered_map<std::string, AssetEntry> assets; // keyed on "<directory>/<file>"
+
+    void buildHeads(const std::string &filepath, AssetEntry &entry);
+};
@@ -0,0 +1,70 @@
+#pragma once
+#include <string>
+#include <string_view>
+
+// Content codings a response body can be stored or sent in, in order of
+// preference when a client rates several the same.
+enum class Encoding
+{
+    IDENTITY,
+    DEFLATE, // zlib format, which is what HTTP calls deflate
+    GZIP,
+    BROTLI,
+    COUNT
+};
+
+// gzip and deflate come from zlib and br from libbrotlienc. Each one is only
+// compiled in when CMake found its library; without them everything goes out
+// as identity.
+namespace compression
+{
+    bool available(Encoding encoding);
+    const char *token(Encoding encoding); // Content-Encoding value, "gzip", "deflate" or "br"
+
+    // text formats worth compressing; images, fonts and archives already are compressed
+    bool compressible(std::string_view contentType);
+
+    // Compresses all of input in one call at the given level. Gzip and deflate
+    // levels go from 1 to 9 and Brotli levels from 0 to 11. Returns false when the encoding
+    // isn't available or the library fails.
+    bool encode(Encoding encoding, std::string_view input, std::string &output, int level);
+
+    // The best of the offered encodings (bit 1 << Encoding) for an Accept-Encoding
+    // value. Uses q-values and "*", and prefers the later Encoding on ties.
+    // Identity is returned when nothing else is acceptable.
+    Encoding negotiate(std::string_view acceptEncoding, unsigned offered);
+}
+
+struct z_stream_s;
+
+// Reusable zlib state for one worker thread, gzip and deflate each get a
+// stream set up on first use and reset between bodies, so a response never
+// pays for deflateInit's allocations. The level follows the thread's CPU use:
+// it steps down towards 1 while the worker is saturated and back up to
+// maxLevel once it has headroom.
+class Compressor
+{
+public:
+    int maxLevel{6};
+
+    Compressor() = default;
+    Compressor(const Compressor &) = delete;
+    Compressor &operator=(const Compressor &) = delete;
+    ~Compressor();
+
+    // starts a new body, false when encoding isn't gzip or deflate or zlib is missing
+    bool begin(Encoding encoding);
+    // compresses the whole body onto the end of output and ends the stream
+    bool compress(std::string_view input, std::string &output);
+    int level() const { return currentLevel; }
+
+private:
+    z_stream_s *streams[2]{nullptr, nullptr}; // deflate, gzip
+    int streamLevels[2]{0, 0};
+    z_stream_s *active{nullptr};
+    int currentLevel{6};
+    long windowStart{0}; // monotonic ns
+    long windowCpu{0};   // thread CPU ns at windowStart
+
+    void adapt();
+};
@@ -0,0 +1,177 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "parser.hpp"
+#include "output.hpp"
+#include "stream.hpp"
+#include "timer_wheel.hpp"
+#include "rate_limiter.hpp"
+#include "scheduler.hpp"
+#include "arena.hpp"
+#include "metrics.hpp"
+
+class Server;
+class OffloadMailbox;
+
+// What the connection's timer is currently counting down to
+enum class Deadline
+{
+    IDLE,   // keep-alive wait for the next request, or the peer draining our output
+    HEADER, // the first bytes of a request arrived, the rest of its headers haven't
+    BODY    // headers complete, waiting for the rest of the body
+};
+
+// State for one client socket owned by an event loop. Everything here is only
+// touched by the loop thread that owns the connection.
+struct Connection
+{
+    int fd{-1};
+    uint64_t id{0};          // unique per loop, fds are reused once closed
+    std::string ip;
+    PeerKey peer;            // binary form of ip, what the rate limiter keys on
+    std::string readBuffer;  // bytes received but not yet consumed by a request
+    RequestParser parser;    // resumes on readBuffer as more bytes arrive
+    OutputQueue output;      // serialized responses not yet accepted by the kernel
+    int requestCount{0};
+    TimerNode timer;         // armed on the owning loop's wheel for the current deadline
+    Deadline deadline{Deadline::IDLE};
+    bool peerClosed{false};
+    bool closeAfterWrite{false};
+    std::unique_ptr<ResponseStream> stream; // response still being produced, later requests wait for it
+    bool offloaded{false};   // a request is on the scheduler, later requests wait for its response
+    OffloadMailbox *mailbox{nullptr}; // where the owning loop collects offloaded responses
+    uint64_t receivedAt{0};  // Metrics::now() of the last read, a request completed by it waits from there
+    uint64_t parseNs{0};     // parse time of the request being received, summed over its reads
+
+    // requests behind a response that isn't fully produced yet have to wait for it
+    bool busy() const { return stream || offloaded; }
+};
+
+// A request for an offload()ed route, copied out of the connection so a
+// scheduler worker can serve it. The worker runs the full Server::handle on
+// its own arena and output queue, then posts the result to the mailbox of the
+// loop that owns the connection, which queues it behind earlier responses.
+struct OffloadedRequest : Task
+{
+    Server *server{nullptr};
+    OffloadMailbox *mailbox{nullptr};
+    uint64_t connection{0}; // Connection::id, the connection may be gone by the time it returns
+    int fd{-1};
+    std::string raw;        // the request bytes, parser spans point into them
+    RequestParser parser;
+    std::string ip;
+    PeerKey peer;
+    int requestCount{0};
+    bool closeAfterWrite{false}; // applied to the connection once the response is back
+    RequestArena arena;
+    OutputQueue output;
+    std::unique_ptr<ResponseStream> stream; // producer still to run, the owning loop pumps it
+    RequestSample sample;   // measured on the loop so far, run() adds the rest and records it
+    uint64_t submittedAt{0};
+
+    void run() override;
+};
+
+// Offloaded requests on their way back to the loop that owns their connection.
+// Workers push, the loop drains it when fd becomes readable.
+class OffloadMailbox
+{
+public:
+    int fd{-1}; // eventfd
+
+    OffloadMailbox();
+    ~OffloadMailbox();
+    OffloadMailbox(const OffloadMailbox &) = delete;
+    OffloadMailbox &operator=(const OffloadMailbox &) = delete;
+
+    void post(OffloadedRequest *request); // any thread
+    std::vector<std::unique_ptr<OffloadedRequest>> take(); // owning loop only, also resets fd
+
+private:
+    std::mutex mutex;
+    std::vector<OffloadedRequest *> done;
+};
+
+// Printable address of the peer on the other end of fd, its binary form goes to key.
+std::string peerAddress(int fd, PeerKey &key);
+
+// Parses and handles the next complete request buffered on the connection,
+// queueing its response on the connection output. Returns false when no complete request
+// is buffered yet. Shared by every I/O backend.
+bool serveNext(Server *server, Connection &conn);
+
+// pipelined requests answered before their responses are flushed together,
+// bounds how much output a client that never reads can make us queue
+static const int PIPELINE_BATCH = 64;
+
+// a streamed response is produced up to this many queued bytes, then waits for the socket
+static const size_t STREAM_WATERMARK = 256 * 1024;
+
+// Lets the connection's streamed response produce output until STREAM_WATERMARK
+// bytes are queued, and drops the stream once it has ended. Called with no send in
+// flight, the producer appends to chunks the kernel may otherwise be reading.
+void pumpStream(Connection &conn);
+
+// Picks the deadline the connection is up against after an I/O event and
+// (re)arms its timer. Idle time restarts with every event, a request's header
+// and body deadlines run from when that phase began however the bytes trickle in.
+// While the server drains for an upgrade an idle connection that has been
+// served expires right away.
+void armDeadline(Server *server, TimerWheel &timers, Connection &conn);
+
+// Handles an expired header or body deadline by queueing a 408 and marking the
+// connection to close once it is written. Returns false for an idle deadline,
+// which just closes.
+bool requestTimedOut(Connection &conn);
+
+// Moves an offloaded request's response onto its connection behind the earlier
+// output, the stream it left running becomes the connection's. The caller
+// flushes and resumes the connection.
+void finishOffloaded(Connection &conn, OffloadedRequest &request);
+
+// One non-blocking, edge-triggered epoll loop. Each loop runs on its own thread
+// and multiplexes every connection handed to it; handlers only ever see fully
+// received requests.
+class EventLoop
+{
+public:
+    int epfd{-1};
+    int wakefd{-1}; // eventfd used by the acceptor to hand over new connections
+    OffloadMailbox mailbox; // responses of offloaded requests coming back from the scheduler
+    std::vector<int> listenfds; // own SO_REUSEPORT listeners, or ones inherited from a replaced process
+    Server *server;
+
+    TimerWheel timers; // deadlines of every connection below
+    std::unordered_map<int, std::unique_ptr<Connection>> connections;
+
+    EventLoop(Server *server);
+    ~EventLoop();
+
+    void run();
+    void addConnection(int fd); // thread-safe, called from the acceptor
+    void listenOn(int fd);      // accept directly on this loop, call before run(), may be called more than once
+    void wake();                // thread-safe, run() then notices Server::draining
+
+private:
+    std::mutex pendingMutex;
+    std::vector<int> pending;
+    uint64_t nextId{1};
+    bool draining{false};
+    bool drained{false}; // reported to the server, nothing left to serve
+
+    void adoptPending();
+    void adopt(int fd);
+    void acceptBatch(int listenfd);
+    void drain();
+    void checkDrained();
+    void onReadable(Connection &conn);
+    void onWritable(Connection &conn);
+    void processRequests(Connection &conn);
+    bool flush(Connection &conn);
+    void closeConnection(Connection &conn);
+    void onTimeout(Connection &conn);
+    void onOffloaded();
+};
@@ -5,8 +5,10 @@
 #include <fstream>
 #include <ctime>
 #include <mutex>
-#include <iomanip>
-#include <sstream>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string_view>
 
 enum class LogLevel
 {
@@ -26,14 +28,57 @@ struct LoggerConfig
     bool showColors = true;                 // Use ANSI colors (terminal)
     bool logToFile = false;                 // Also log to file
     std::string logFilePath = "server.log"; // Log file path
+    size_t queueCapacity = 8192;            // Lines buffered per thread, rounded up to a power of two
 };
 
+struct LoggerStats
+{
+    uint64_t logged;  // lines accepted into a queue
+    uint64_t dropped; // lines thrown away because their thread's queue was full
+    uint64_t written; // lines the writer thread has output
+};
+
+struct LogRecord
+{
+    LogLevel level;
+    time_t time;
+    std::string message;
+};
+
+// Single producer, single consumer queue owned by one logging thread and
+// drained by the writer thread. Full queues drop the new line instead of
+// blocking the caller.
+struct LogRing
+{
+    std::vector<LogRecord> slots;
+    size_t mask{0};
+    alignas(64) std::atomic<size_t> head{0}; // advanced by the writer
+    alignas(64) std::atomic<size_t> tail{0}; // advanced by the owning thread
+    std::atomic<uint64_t> logged{0};
+    std::atomic<uint64_t> dropped{0};
+    LogRing *next{nullptr};
+
+    bool push(LogRecord &&record);
+};
+
+// Callers only format their message and push it on a per-thread queue, one
+// background thread timestamps, colors and writes everything in batches.
 class Logger
 {
 private:
     LoggerConfig config;
     std::ofstream fileStream;
-    std::mutex logMutex;
+    std::mutex configMutex; // configure() against the writer thread, callers never take it
+
+    std::atomic<LogRing *> rings{nullptr}; // every thread that ever logged, never freed
+    std::atomic<bool> stopping{false};
+    std::atomic<uint64_t> written{0};
+    uint64_t droppedReported{0};
+    std::thread writer;
+
+    // timestamp text is rebuilt at most once a second
+    time_t cachedTime{0};
+    char cachedTimestamp[32]{};
 
     // ANSI color codes
     const std::string RESET = "\033[0m";
@@ -83,87 +128,23 @@ private:
         }
     }
 
-    std::string getTimestamp()
-    {
-        auto now = std::time(nullptr);
-        auto tm = *std::localtime(&now);
-        std::ostringstream oss;
-        oss << std::put_time(&tm, "%Y-%m-%d %H:%M:%S");
-        return oss.str();
-    }
-
-    void writeLog(LogLevel level, const std::string &message)
-    {
-        if (level < config.minLevel)
-            return;
-
-        std::lock_guard<std::mutex> lock(logMutex);
-
-        std::ostringstream logLine;
-        std::ostringstream coloredLine;
-
-        // Build log line
-        if (config.showTimestamp)
-        {
-            logLine << "[" << getTimestamp() << "] ";
-            coloredLine << GRAY << "[" << getTimestamp() << "] " << RESET;
-        }
-
-        if (config.showLevel)
-        {
-            logLine << "[" << getLevelString(level) << "] ";
-            if (config.showColors)
-            {
-                coloredLine << getLevelColor(level) << "[" << getLevelString(level) << "]" << RESET << " ";
-            }
-            else
-            {
-                coloredLine << "[" << getLevelString(level) << "] ";
-            }
-        }
-
-        logLine << message;
-        coloredLine << message;
-
-        // Output to console
-        if (config.showColors)
-        {
-            std::cout << coloredLine.str() << std::endl;
-        }
-        else
-        {
-            std::cout << logLine.str() << std::endl;
-        }
+    const char *getTimestamp(time_t now);
+    LogRing *threadRing();
+    void writeLog(LogLevel level, std::string message);
 
-        // Output to file
-        if (config.logToFile && fileStream.is_open())
-        {
-            fileStream << logLine.str() << std::endl;
-            fileStream.flush();
-        }
-    }
+    // ---- Writer thread
+    void writerLoop();
+    bool drain();
+    void format(const LogRecord &record, std::string &console, std::string &file);
 
 public:
-    Logger() = default;
-
-    Logger(LoggerConfig cfg) : config(cfg)
-    {
-        if (config.logToFile)
-        {
-            fileStream.open(config.logFilePath, std::ios::app);
-        }
-    }
-
-    ~Logger()
-    {
-        if (fileStream.is_open())
-        {
-            fileStream.close();
-        }
-    }
+    Logger();
+    Logger(LoggerConfig cfg);
+    ~Logger(); // drains whatever is still queued, so lines logged right before exit() are kept
 
     void configure(LoggerConfig cfg)
     {
+        std::lock_guard<std::mutex> lock(configMutex);
         config = cfg;
         if (config.logToFile && !fileStream.is_open())
         {
@@ -176,59 +157,75 @@ public:
         config.minLevel = level;
     }
 
-    // Logging methods
+    // Logging methods, a filtered level returns before the message is copied
     void debug(const std::string &message)
     {
+        if (LogLevel::DEBUG < config.minLevel)
+            return;
         writeLog(LogLevel::DEBUG, message);
     }
 
     void info(const std::string &message)
     {
+        if (LogLevel::INFO < config.minLevel)
+            return;
         writeLog(LogLevel::INFO, message);
     }
 
     void warn(const std::string &message)
     {
+        if (LogLevel::WARN < config.minLevel)
+            return;
         writeLog(LogLevel::WARN, message);
     }
 
     void error(const std::string &message)
     {
+        if (LogLevel::ERROR < config.minLevel)
+            return;
         writeLog(LogLevel::ERROR, message);
     }
 
     void fatal(const std::string &message)
     {
+        if (LogLevel::FATAL < config.minLevel)
+            return;
         writeLog(LogLevel::FATAL, message);
     }
 
     // Log HTTP request
-    void request(const std::string &method, const std::string &path, const std::string &status)
+    void request(std::string_view method, std::string_view path, const std::string &status)
     {
+        if (LogLevel::INFO < config.minLevel)
+            return;
+
         std::string color = CYAN;
         // Extract status code from string (e.g., "200 OK" -> 200)
-        int statusCode = 200;
-        try {
-            statusCode = std::stoi(status);
-        } catch (...) {}
-        
+        int statusCode = atoi(status.c_str());
+
         if (statusCode >= 400)
             color = RED;
         else if (statusCode >= 300)
             color = YELLOW;
 
-        std::ostringstream oss;
+        std::string line;
         if (config.showColors)
         {
-            oss << color << method << RESET << " " << path << " " << color << status << RESET;
+            line.append(color).append(method).append(RESET).append(" ").append(path);
+            line.append(" ").append(color).append(status).append(RESET);
         }
         else
         {
-            oss << method << " " << path << " " << status;
+            line.append(method).append(" ").append(path).append(" ").append(status);
         }
 
-        writeLog(LogLevel::INFO, oss.str());
+        writeLog(LogLevel::INFO, std::move(line));
     }
+
+    LoggerStats stats();
+
+    // writes out every line queued so far on the calling thread, for exits that skip ~Logger
+    void flush() { drain(); }
 };
 
 // Global logger instance (optional)
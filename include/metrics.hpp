@@ -0,0 +1,104 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <ctime>
+
+class Router;
+
+// HDR-style log-linear histogram of durations in nanoseconds: every power of
+// two is split into 8 linear sub-buckets, so a recorded value is off by less
+// than 1/8 anywhere from 1ns up to MAX_BITS (~69s, longer ones land in the
+// last bucket). 272 buckets, about 2KB. One thread records, any thread may
+// read meanwhile.
+class LatencyHistogram
+{
+public:
+    static const int SUB_BITS = 3;
+    static const int SUB_BUCKETS = 1 << SUB_BITS;
+    static const int MAX_BITS = 36;
+    static const int BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_BUCKETS;
+
+    std::atomic<uint64_t> counts[BUCKETS]{};
+    std::atomic<uint64_t> sum{0}; // nanoseconds
+
+    void record(uint64_t ns);
+    static int bucketOf(uint64_t ns);
+    static uint64_t upperBound(int bucket); // largest value that lands in bucket
+};
+
+// Everything counted for one route on one thread, allocated the first time the
+// thread serves the route. Padded to cache lines, so threads never write to a
+// line another one writes to.
+struct alignas(64) RouteStats
+{
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> statusClasses[5]{}; // 1xx to 5xx
+    std::atomic<uint64_t> bytesIn{0};  // request bytes parsed
+    std::atomic<uint64_t> bytesOut{0}; // response bytes queued while the handler ran
+    LatencyHistogram parse;     // scanning the request, summed over every read it arrived in
+    LatencyHistogram handler;   // Server::handle, rate limiting and middlewares included
+    LatencyHistogram queueWait; // from the read that completed the request until it was parsed, plus scheduler wait
+};
+
+// What serveRequest measured for one request, see RouteStats
+struct RequestSample
+{
+    size_t route{0}; // RouteEntry::id, Router::size() for requests no route matched
+    int status{0};
+    uint64_t bytesIn{0};
+    uint64_t bytesOut{0};
+    uint64_t parseNs{0};
+    uint64_t handlerNs{0};
+    uint64_t queueNs{0};
+};
+
+// Per-thread slot, allocated the first time a thread records anything
+struct alignas(64) WorkerMetrics
+{
+    const void *owner{nullptr}; // the Metrics it belongs to
+    std::atomic<uint64_t> connectionsOpened{0};
+    std::atomic<uint64_t> connectionsClosed{0};
+    // one per route plus one for unmatched requests, null until the thread serves it
+    std::unique_ptr<std::atomic<RouteStats *>[]> routes;
+};
+
+// Request metrics of the whole server. Every I/O loop and scheduler worker
+// records into a slot of its own with plain relaxed stores, no shared cache
+// line is written on the request path. A scrape walks every slot and merges
+// them, so the cost is paid by whoever reads /metrics.
+class Metrics
+{
+public:
+    static const int MAX_WORKERS = 256;
+
+    Metrics() = default;
+    Metrics(const Metrics &) = delete;
+    Metrics &operator=(const Metrics &) = delete;
+
+    // once, with the routes compiled and before any thread records
+    void configure(size_t routeCount);
+
+    void record(const RequestSample &sample);
+    void connectionOpened();
+    void connectionClosed();
+
+    // Prometheus text exposition format, version 0.0.4
+    std::string render(const Router &router) const;
+
+    static uint64_t now()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+private:
+    std::atomic<WorkerMetrics *> workers[MAX_WORKERS]{};
+    std::atomic<int> workerCount{0};
+    size_t routeSlots{1};
+    bool configured{false};
+
+    WorkerMetrics &local();
+};
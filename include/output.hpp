@@ -0,0 +1,66 @@
+#pragma once
+#include <string>
+#include <deque>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// One piece of a connection's pending output: bytes we own, bytes owned by
+// something that outlives the connection (the asset cache), or a range of an
+// open file that goes out through sendfile(2) without entering userspace.
+struct OutputChunk
+{
+    std::string data;
+    const char *shared{nullptr}; // not owned, used instead of data when set
+    size_t sharedLength{0};
+    bool sealed{false}; // a whole body moved in, later writes never append to it
+    int fileFd{-1}; // owned, closed once the range is sent
+    off_t fileOffset{0};
+    size_t fileRemaining{0};
+
+    bool isFile() const { return fileFd >= 0; }
+    const char *bytes() const { return shared ? shared : data.data(); }
+    size_t size() const { return shared ? sharedLength : data.size(); }
+};
+
+// Ordered response output of one connection. Responses append to it, the I/O
+// loop drains it from the front as the socket accepts data.
+class OutputQueue
+{
+public:
+    static const int MAX_IOV = 256; // a full pipelined batch of cached responses fits one sendmsg
+
+    std::deque<OutputChunk> chunks;
+    size_t frontOffset{0}; // bytes of the front memory chunk already sent
+    std::string spare;     // buffer of a drained chunk, reused so serializing headers doesn't allocate
+
+    OutputQueue() = default;
+    OutputQueue(const OutputQueue &) = delete;
+    OutputQueue &operator=(const OutputQueue &) = delete;
+    ~OutputQueue();
+
+    // the end of the queue at some point, bytesSince() counts what was appended after it
+    struct Mark
+    {
+        size_t chunks{0};
+        size_t backSize{0};
+    };
+
+    bool empty() const { return chunks.empty(); }
+    size_t pending() const; // bytes not yet sent, walks the queue
+    Mark mark() const;
+    size_t bytesSince(const Mark &mark) const; // only walks the chunks added since, nothing may be sent meanwhile
+    void append(const char *data, size_t size);
+    std::string &tail(); // owned chunk at the back to serialize into directly
+    void appendOwned(std::string &&data); // large bodies become their own iovec, no copy
+    void appendShared(const char *data, size_t size); // data must outlive the queue
+    void appendFile(int fd, off_t offset, size_t length); // takes ownership of fd
+    void splice(OutputQueue &other); // moves every chunk of an unsent queue to the back, other is left empty
+
+    // the memory chunks at the front as an iovec array for one writev/sendmsg
+    int gather(iovec *iov, int max) const;
+    // drops bytes the kernel accepted from the gathered memory chunks
+    void consume(size_t bytes);
+
+    void popFront();
+    void clear();
+};
@@ -0,0 +1,86 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Offset and length of a token inside the connection's read buffer. Offsets
+// survive the buffer being reallocated as more bytes arrive.
+struct Span
+{
+    uint32_t offset{0};
+    uint32_t length{0};
+};
+
+struct HeaderSpan
+{
+    Span name;
+    Span value; // optional whitespace already trimmed
+};
+
+enum class ParseResult
+{
+    INCOMPLETE, // need more bytes, call parse() again once they arrive
+    COMPLETE,   // a whole request (headers and body) is in the buffer
+    ERROR       // malformed or over a limit, errorStatus says how to answer
+};
+
+// Incremental HTTP/1.1 request parser. Each call to parse() only looks at the
+// bytes that arrived since the previous call, so a request trickling in over
+// many reads is scanned exactly once. It records spans instead of copying and
+// never allocates; limits are enforced while the bytes stream in.
+class RequestParser
+{
+public:
+    static const int MAX_HEADERS = 64;
+
+    size_t maxHeaderBytes{16384};
+    size_t maxBodyBytes{8092};
+
+    Span method;
+    Span target;
+    Span version;
+    Span body;
+    HeaderSpan headers[MAX_HEADERS];
+    int headerCount{0};
+
+    size_t contentLength{0};
+    bool http10{false};
+    bool connectionClose{false};
+    bool connectionKeepAlive{false};
+    int errorStatus{0};
+
+    void reset();
+    ParseResult parse(const char *data, size_t size);
+
+    // bytes the complete request occupies at the front of the buffer
+    size_t messageLength() const { return bodyStart + contentLength; }
+    bool keepAlive() const { return !connectionClose && (!http10 || connectionKeepAlive); }
+    bool inBody() const { return state == State::BODY; } // headers done, body still arriving
+
+private:
+    enum class State
+    {
+        METHOD,
+        TARGET,
+        VERSION,
+        REQUEST_LINE_LF,
+        HEADER_START,
+        HEADER_NAME,
+        HEADER_VALUE_START,
+        HEADER_VALUE,
+        HEADER_LF,
+        HEADERS_END_LF,
+        BODY,
+        DONE
+    };
+
+    State state{State::METHOD};
+    size_t position{0};
+    size_t tokenStart{0};
+    size_t valueEnd{0};
+    size_t bodyStart{0};
+    bool seenContentLength{false};
+
+    ParseResult fail(int status);
+    bool onHeader(const char *data, const HeaderSpan &header);
+    ParseResult endHeaders(size_t size);
+};
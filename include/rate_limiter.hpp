@@ -0,0 +1,61 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+
+// Binary peer address, IPv4 stored as an IPv4-mapped IPv6 address (::ffff:a.b.c.d)
+struct PeerKey
+{
+    uint8_t bytes[16]{};
+
+    bool operator==(const PeerKey &other) const { return memcmp(bytes, other.bytes, 16) == 0; }
+};
+
+struct PeerKeyHash
+{
+    size_t operator()(const PeerKey &key) const
+    {
+        uint64_t hi, lo;
+        memcpy(&hi, key.bytes, 8);
+        memcpy(&lo, key.bytes + 8, 8);
+        // splitmix style finalizer, the low bits pick the shard
+        uint64_t h = hi * 0x9e3779b97f4a7c15ULL ^ lo;
+        h ^= h >> 31;
+        h *= 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 29;
+        return h;
+    }
+};
+
+// GCRA limiter: LIMIT requests per WINDOW per peer, bursts up to LIMIT, with
+// continuous refill on the monotonic clock. Each peer costs one timestamp (its
+// theoretical arrival time). Peers are spread over independently locked shards.
+// An entry whose arrival time has passed is the same as no entry, which is
+// what eviction relies on.
+class RateLimiter
+{
+public:
+    static const int SHARDS = 64;
+
+    void configure(int limit, int windowSeconds, size_t maxEntries);
+
+    // false when the peer is over its rate, retryAfter is then set in seconds
+    bool allow(const PeerKey &peer, int &retryAfter);
+    size_t size();
+
+private:
+    struct alignas(64) Shard
+    {
+        std::mutex mutex;
+        std::unordered_map<PeerKey, int64_t, PeerKeyHash> arrivals; // theoretical arrival time, ns
+        int64_t nextSweep{0};
+    };
+
+    Shard shards[SHARDS];
+    int64_t interval{1}; // ns between requests at the sustained rate
+    int64_t burst{0};    // how far ahead of now the arrival time may run
+    size_t maxPerShard{16384};
+
+    void evict(Shard &shard, int64_t now);
+};
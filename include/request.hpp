@@ -14,29 +14,88 @@
 #include <fstream>
 #include <functional>
 #include "json.hpp"
+#include "parser.hpp"
+#include "rate_limiter.hpp"
+#include <memory_resource>
+#include <string_view>
 
 using json = nlohmann::json;
 
+struct RouteEntry;
+
+// Every string and container lives in the request arena, see RequestArena,
+// except bodyJson. nlohmann::json default-constructs its allocators, so an arena
+// one could only find the arena through a thread-local; a value a handler copies
+// or moves out of the request would then be freed through the wrong resource, or
+// dangle once the arena is reset.
 struct RequestBuffer
 {
-    std::string method;
-    std::string path;
-    std::string version;
-    std::unordered_map<std::string, std::string> headers;
-    std::unordered_map<std::string, std::string> queryParams;
-    std::string body;
-    json bodyJson;
-    std::string ip; 
-    std::map<std::string, std::string> cookies;
-    std::map<std::string, std::string> params; // this one her is to contain the dynamic params from the  URL
+    std::pmr::string method;
+    std::pmr::string path;
+    std::pmr::string version;
+    std::pmr::unordered_map<std::pmr::string, std::pmr::string> headers;
+    std::pmr::unordered_map<std::pmr::string, std::pmr::string> queryParams;
+    std::pmr::string body;
+    json bodyJson; // heap allocated, see above
+    std::pmr::string ip; 
+    std::pmr::map<std::pmr::string, std::pmr::string> cookies;
+    std::pmr::map<std::pmr::string, std::pmr::string> params; // this one her is to contain the dynamic params from the  URL
+
+    RequestBuffer(std::pmr::memory_resource *arena)
+        : method(arena), path(arena), version(arena), headers(arena), queryParams(arena), body(arena),
+          ip(arena), cookies(arena), params(arena) {}
+};
+
+struct ViewPair
+{
+    std::string_view name;
+    std::string_view value;
+};
+
+// The request as views into the connection's read buffer, nothing is copied.
+// Only valid while the handler runs. path and query values are already
+// percent-decoded; they point into the arena instead when decoding changed
+// bytes, and straight into the buffer otherwise.
+struct RequestView
+{
+    std::string_view method;
+    std::string_view target;  // as sent, query string included
+    std::string_view path;    // decoded, without the query string
+    std::string_view version;
+    std::string_view body;
+    std::string_view ip;
+    std::pmr::vector<ViewPair> headers;
+    std::pmr::vector<ViewPair> queryParams;
+    std::pmr::vector<ViewPair> cookies;
+    std::pmr::vector<ViewPair> params; // dynamic route params, filled by the router
+
+    RequestView(std::pmr::memory_resource *arena) : headers(arena), queryParams(arena), cookies(arena), params(arena) {}
+
+    // empty view when absent, header names compare case-insensitively
+    std::string_view header(std::string_view name) const;
+    std::string_view queryParam(std::string_view name) const;
+    std::string_view cookie(std::string_view name) const;
+    std::string_view param(std::string_view name) const;
 };
 
 class Request{
     public:
-        RequestBuffer data;
-        std::string recvData; 
+        RequestBuffer data; // copied request, left empty when zeroCopy is set
+        RequestView view;   // filled instead of data when zeroCopy is set
+        bool zeroCopy{false};
         int connfd; 
-        Request(int connfd);
-        void parseRequest();
-        void parseCookies(std::string cookieString);
+        PeerKey peer; // binary peer address, set by the I/O loop
+        const RouteEntry *route{nullptr}; // what Server::handle matched, null when nothing did
+        Request(int connfd, const RequestParser &parser, const char *raw,
+                std::pmr::memory_resource *arena = std::pmr::get_default_resource(), bool zeroCopy = false);
+        void parseRequest(const RequestParser &parser, const char *raw);
+        void parseView(const RequestParser &parser, const char *raw, std::pmr::memory_resource *arena);
+        void parseCookies(std::string_view cookieString);
+
+        // whichever representation is in use
+        std::string_view method() const { return zeroCopy ? view.method : std::string_view(data.method); }
+        std::string_view path() const { return zeroCopy ? view.path : std::string_view(data.path); }
+        // the path routing sees once the middlewares ran: no query string, percent-decoded
+        std::string_view routePath() const;
+        std::string_view header(std::string_view name) const; // case-insensitive, empty when absent
 };
\ No newline at end of file
@@ -1,9 +1,16 @@
 #pragma once
 #include <iostream> 
 #include <map>
+#include <memory>
+#include <memory_resource>
+#include <cstdint>
+#include <string_view>
 #include <fstream>
 #include <sys/socket.h>
 #include <chrono>
+#include "output.hpp"
+#include "asset_cache.hpp"
+#include "stream.hpp"
 
 
 struct cookieOptions{
@@ -19,23 +26,72 @@ struct cookieOptions{
     
 };
 
+// A static representation a Range request is cut from: bytes in memory that
+// outlive the response, or a file the parts are sendfile()d from (not owned).
+struct RangeSource
+{
+    const char *memory{nullptr};
+    int fd{-1};
+    uint64_t size{0};
+    std::string_view contentType;
+    std::string_view etag;
+    std::string_view lastModified;
+    Encoding encoding{Encoding::IDENTITY};
+};
+
 class Response{
     public: 
         int connfd;
         std::string base_path{"public"};
         std::string notFoundPath{"public/404.html"};
         std::string status{"200 OK"};
-        std::map<int, std::string> STATUSES;
-        
-        std::map<std::string, std::string> headers;
+        std::pmr::map<std::pmr::string, std::pmr::string> headers; // in the request arena
         std::string body{""};
+        OutputQueue *out; // connection output, flushed by the I/O loop; the only way anything is sent
+        const AssetCache *assets{nullptr}; // sendFile serves cached files from memory
+        std::string_view acceptEncoding; // request's Accept-Encoding, picks the static variant or dynamic coding
+        std::string_view ifNoneMatch;     // request validators, sendFile answers 304 when they still match
+        std::string_view ifModifiedSince;
+        std::string_view range;   // Range and If-Range, sendFile answers 206/416 for static files
+        std::string_view ifRange;
+        bool headOnly{false}; // HEAD request: every send writes the GET headers and no body
+        bool http10{false};   // no chunked encoding, a streamed body ends by closing the connection
+        std::unique_ptr<ResponseStream> streaming; // set by the first write(), stream() or end()
+        size_t compressMinSize{0}; // dynamic bodies from this size up are gzip/deflate compressed, 0 never
+        int compressLevel{6};      // highest level, lowered while the worker is CPU bound
 
-        Response(int connfd);
+        Response(int connfd, OutputQueue &out, std::pmr::memory_resource *arena = std::pmr::get_default_resource());
         ~Response();
         void sendFile(std::string &filepath, int statusCode=200);
         void sendHTML(std::string html, int statusCode=200);
-        void setHTTPHeader(std::string contentType, std::string ContentLength);
+        void sendHTML(std::string_view html, int statusCode=200);
+        void sendHTML(const char *html, int statusCode=200);
+        void sendJSON(std::string json, int statusCode=200);
+        void sendJSON(std::string_view json, int statusCode=200);
+        void sendCached(const CachedAsset &asset);
+        bool sendRanges(const RangeSource &source);
+        void writePart(const RangeSource &source, uint64_t offset, uint64_t length);
+        void sendNotModified(std::string_view etag, std::string_view lastModified);
+        bool notModified(std::string_view etag, std::string_view lastModified, time_t modified) const;
+        void setHTTPHeader(std::string_view key, std::string_view value);
         void setCookie(std::string key, std::string value, cookieOptions options);
         std::string prepareRequest(); 
-        std::string getContentType(const std::string &filepath);
+        void writeOut(const char *data, size_t size);
+        void serializeHead(std::string &buffer, bool cached=false);
+        void writeResponse(std::string &&body);
+
+        // Streaming: the head goes out with the first call, without Content-Length
+        void write(std::string_view chunk);
+        void write(const char *chunk);
+        void write(std::string &&chunk);
+        void trailer(std::string_view name, std::string_view value);
+        void end();
+        // produce the body as the socket drains instead of all at once, see ResponseStream
+        void stream(ResponseStream::Producer producer);
+        void compressBody(std::string &body);
+        static std::string getContentType(const std::string &filepath);
+        void beginStream();
+
+        // "200 OK" style status line text, empty for codes we don't know
+        static const std::string &statusLine(int statusCode);
 };
\ No newline at end of file
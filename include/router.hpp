@@ -0,0 +1,67 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <string_view>
+#include <unordered_map>
+#include "parser.hpp"
+
+class Request;
+class Response;
+
+using Handler = std::function<void(Request &, Response &)>;
+
+// What a registered route resolves to: the handler plus the names of its
+// :param and * captures, in the order they appear in the pattern.
+struct RouteEntry
+{
+    size_t id{0}; // index in registration order, what metrics are kept under
+    std::string method;
+    std::string pattern;
+    Handler handler;
+    std::vector<std::string> paramNames;
+    bool offload{false}; // served on the scheduler instead of the I/O loop, see Server::offload
+};
+
+// Result of a lookup. Params are spans into the matched path, nothing is
+// copied until the caller decides it needs the values as strings.
+struct RouteMatch
+{
+    static const int MAX_PARAMS = 16;
+
+    const RouteEntry *route{nullptr};
+    Span params[MAX_PARAMS];
+    int paramCount{0};
+};
+
+// Compressed radix tree per method. Patterns are made of static text,
+// ":name" segments (one path segment, never empty) and a trailing "*" or
+// "*name" (the rest of the path, may be empty). At every node a static
+// continuation is tried first, then a param, then the wildcard, backtracking
+// when a more specific branch dead-ends further down.
+class Router
+{
+public:
+    void add(const std::string &method, const std::string &pattern, Handler handler, bool offload = false);
+    bool match(std::string_view method, std::string_view path, RouteMatch &result) const;
+    void clear();
+    size_t size() const { return routes.size(); }
+    const RouteEntry &entry(size_t id) const { return *routes[id]; }
+
+private:
+    struct Node
+    {
+        std::string prefix; // static text consumed by this node
+        std::vector<std::unique_ptr<Node>> children; // static continuations, distinct first bytes
+        std::unique_ptr<Node> paramChild;
+        std::unique_ptr<Node> wildcardChild;
+        const RouteEntry *route{nullptr};
+    };
+
+    std::unordered_map<std::string, std::unique_ptr<Node>> trees; // one root per method
+    std::vector<std::unique_ptr<RouteEntry>> routes;
+
+    static Node *insertStatic(Node *node, const std::string &text);
+    static bool matchNode(const Node *node, const char *path, size_t length, size_t position, RouteMatch &result);
+};
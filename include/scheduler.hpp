@@ -0,0 +1,89 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <cstdint>
+
+// Unit of work for the Scheduler. run() owns the task from then on, it deletes
+// or hands itself on when done.
+struct Task
+{
+    virtual ~Task() = default;
+    virtual void run() = 0;
+};
+
+// Chase-Lev work-stealing deque. Only the owning thread pushes and pops, at
+// the bottom; any other thread steals from the top. Grows without bound, the
+// arrays it outgrew stay alive until it is destroyed since a thief may still
+// be reading one.
+class WorkDeque
+{
+public:
+    WorkDeque();
+    ~WorkDeque();
+    WorkDeque(const WorkDeque &) = delete;
+    WorkDeque &operator=(const WorkDeque &) = delete;
+
+    void push(Task *task); // owner only
+    Task *pop();           // owner only, newest first
+    Task *steal();         // any thread, oldest first, nullptr when empty or lost a race
+    bool empty() const;
+
+private:
+    struct Ring
+    {
+        int64_t capacity; // power of two
+        std::unique_ptr<std::atomic<Task *>[]> slots;
+
+        explicit Ring(int64_t capacity);
+        Task *get(int64_t i) const { return slots[i & (capacity - 1)].load(std::memory_order_relaxed); }
+        void put(int64_t i, Task *task) { slots[i & (capacity - 1)].store(task, std::memory_order_relaxed); }
+    };
+
+    alignas(64) std::atomic<int64_t> top{0};
+    alignas(64) std::atomic<int64_t> bottom{0};
+    std::atomic<Ring *> ring;
+    std::vector<std::unique_ptr<Ring>> rings; // every array ever used, the last one is current
+};
+
+// Work-stealing pool for handlers too slow or blocking to run on an I/O loop.
+// Every thread that submits work owns a deque: I/O loops attach() one, each
+// worker has its own. Workers pop their own deque first, then steal from the
+// others starting at a random one, and sleep once everything is empty.
+// Threads that never attached go through a locked injection queue.
+class Scheduler
+{
+public:
+    static const int MAX_DEQUES = 256;
+
+    Scheduler() = default;
+    Scheduler(const Scheduler &) = delete;
+    Scheduler &operator=(const Scheduler &) = delete;
+
+    void start(int threads); // detached workers, like the I/O loops
+    void attach();            // gives the calling thread a deque of its own, call before its first submit()
+    void submit(Task *task);
+    int threads() const { return workerCount; }
+    static bool onWorker(); // the calling thread is one of the workers
+
+private:
+    std::atomic<WorkDeque *> deques[MAX_DEQUES]{};
+    std::atomic<int> dequeCount{0};
+    int workerCount{0};
+
+    std::mutex injectMutex;
+    std::deque<Task *> injected;
+    std::atomic<size_t> injectedCount{0};
+
+    std::mutex sleepMutex;
+    std::condition_variable wakeup;
+    std::atomic<int> sleeping{0};
+
+    WorkDeque *addDeque();
+    Task *find(WorkDeque *own, uint64_t &seed);
+    bool idle();
+    void workerLoop(WorkDeque *own);
+};
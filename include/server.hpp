@@ -13,8 +13,18 @@
 #include <functional>
 #include "request.hpp"
 #include "response.hpp"
+#include "event_loop.hpp"
+#include "uring_loop.hpp"
+#include "asset_cache.hpp"
+#include "router.hpp"
+#include "rate_limiter.hpp"
+#include "scheduler.hpp"
+#include "metrics.hpp"
 #include <map>
+#include <set>
+#include <atomic>
 #include <vector>
+#include <memory>
 
 struct CorsConfig
 {
@@ -23,6 +33,12 @@ struct CorsConfig
     std::string headers;
 };
 
+enum class IOBackend
+{
+    EPOLL,
+    IO_URING // falls back to EPOLL when the kernel lacks the ring features
+};
+
 using Next = std::function<void()>;
 using Middleware = std::function<void(Request &, Response &, Next)>;
 
@@ -32,31 +48,85 @@ public:
     int NOT{4};
     int PORT{3000};
     int REQUEST_BODY_SIZE_LIMIT{8092}; //8 KB
+    int REQUEST_HEADER_SIZE_LIMIT{16384}; // 16 KB
     std::map<std::pair<std::string, std::string>, std::function<void(Request &, Response &)>> pathMap;
     std::vector<Middleware> middlewares;
     std::map<std::string, std::string> CORS;
     bool RateLimitEnabled{true};
     int REQUEST_LIMIT{1000000};
     int REQUEST_LIMIT_WINDOW{1};
+    size_t RATE_LIMIT_MAX_ENTRIES{1 << 20}; // peers tracked at once, idle ones are evicted first
 
-    int CONNECTION_TIMEOUT{2}; // in seconds 
+    IOBackend IO_BACKEND{IOBackend::EPOLL};
+    bool REUSE_PORT{false}; // every loop binds its own SO_REUSEPORT listener and accepts directly
+    int CONNECTION_TIMEOUT{2}; // in seconds, idle keep-alive and stalled writes
+    int HEADER_TIMEOUT{5}; // seconds from a request's first byte to the end of its headers, then 408
+    int BODY_TIMEOUT{10}; // seconds from the end of the headers to the end of the body, then 408
     int CONNECTION_MAX_REQUESTS{100}; 
+    bool ZERO_COPY_REQUESTS{false}; // handlers read req.view (string_views into the read buffer) instead of req.data
+    size_t ASSET_CACHE_BUDGET{8 * 1024 * 1024}; // bytes of public/ kept in memory, 0 disables the cache
+    size_t ASSET_CACHE_MAX_FILE_SIZE{256 * 1024}; // larger files are always sendfile()d
+    size_t COMPRESSION_BUDGET{32 * 1024 * 1024}; // bytes of gzip/br variants of public/ text files, 0 disables them
+    size_t COMPRESSION_MAX_FILE_SIZE{16 * 1024 * 1024}; // larger files are only served uncompressed
+    size_t COMPRESSION_MIN_SIZE{1024}; // dynamic text bodies from this size up are gzip/deflate compressed, 0 disables
+    int COMPRESSION_LEVEL{6}; // zlib level for dynamic bodies, stepped down while a worker is saturated
+    int OFFLOAD_THREADS{0}; // scheduler workers for offload()ed routes, 0 is one per core
+    std::set<std::pair<std::string, std::string>> offloadedRoutes; // {route, method}, like pathMap
+    bool offloading{false}; // some route is offloaded, set by compileRoutes()
+    bool HOT_UPGRADE{false}; // SIGUSR2 starts the binary on disk and hands it the listeners, see upgrade.hpp
+    int UPGRADE_TIMEOUT{30}; // seconds the new binary gets to start accepting, else this process carries on
+    int DRAIN_TIMEOUT{30}; // seconds a replaced process keeps serving its open connections before it exits
+    bool METRICS{true}; // per-route counters and latency histograms, see Metrics
+    std::string METRICS_PATH{"/metrics"}; // Prometheus scrape endpoint, empty to not register it
+    bool METRICS_LOCAL_ONLY{true}; // METRICS_PATH answers loopback peers only, others get a 404
+
+    RateLimiter rateLimiter; // REQUEST_LIMIT per REQUEST_LIMIT_WINDOW per peer, configured by start()
 
-    std::unordered_map<std::string, std::pair<std::time_t, int>> rateLimitBucket; //first is timestamp, then token count  
+    std::vector<std::unique_ptr<EventLoop>> loops; // one per thread, NOT of them
+    std::vector<std::unique_ptr<UringLoop>> uringLoops; // used instead of loops with IOBackend::IO_URING
+    AssetCache assets; // filled by start(), read-only while serving
+    Router router; // compiled from pathMap by start()
+    Scheduler scheduler; // runs offloaded routes, started by start() when there are any
+    Metrics metrics; // recorded by every loop and scheduler worker, merged by serveMetrics()
+    std::vector<int> listeners; // every listening socket, what an upgrade hands over
+    std::vector<int> inherited; // listeners handed over by the process we replaced, used up by listener()
+    std::atomic<bool> draining{false}; // a new process accepts now, the loops close connections as they go idle
 
 
     Server(int NOT, int PORT);
     ~Server();
 
     void start();
-    static void worker(std::vector<int> &conns, Server *server);
+    int openListener(bool reusePort);
+    int listener(bool reusePort); // an inherited listener if one is left, else a new one
+    void loopDrained(); // each loop once, from its own thread, when its last connection closed
+    bool startUring();
+    void handle(Request &request, Response &response);
+    void compileRoutes();
     void registerRoute(std::string route, std::string method, std::function<void(Request &, Response &)>);
     void setCors(CorsConfig corsConfig);
     void use(Middleware func);
 
+    // Runs the route's handler on the work-stealing scheduler instead of the I/O
+    // loop, for CPU heavy or blocking handlers. Other connections of the loop keep
+    // being served meanwhile; later requests on the same connection still wait.
+    void offload(std::string route, std::string method = "GET");
+    bool offloaded(const Request &request) const; // the request's route is offloaded
+
     void get(std::string route, std::function<void(Request &req, Response &res)> callback);
     void post(std::string route, std::function<void(Request &req, Response &res)> callback);
     void put(std::string route, std::function<void(Request &req, Response &res)> callback);
     void patch(std::string route, std::function<void(Request &req, Response &res)> callback);
     void del(std::string route, std::function<void(Request &req, Response &res)> callback);
+
+private:
+    int drainfd{-1}; // eventfd, wakes the shared acceptor when draining starts
+    std::mutex drainMutex;
+    std::condition_variable drainCondition;
+    size_t drainedLoops{0};
+
+    void adoptInherited();
+    void serveMetrics(Request &request, Response &response);
+    void accepting();
+    void upgradeLoop();
 };
\ No newline at end of file
@@ -0,0 +1,30 @@
+#pragma once
+#include <cstddef>
+
+// Delimiter and character-class scanning for the request parser, 16 or 32
+// bytes per step. The implementation is picked once at startup from what the
+// CPU supports (AVX2, then SSE2, then plain C++), every kernel returns the
+// same result at every level.
+namespace simd
+{
+    enum class Level
+    {
+        SCALAR,
+        SSE2,
+        AVX2
+    };
+
+    Level level();
+    const char *levelName(Level level);
+    void setLevel(Level level); // forces a level, for comparing kernels; clamped to what the CPU has
+
+    // Each returns the index of the first byte in [data, data + size) that
+    // stops the scan, or size when there is none.
+
+    // first byte that is not an RFC 9110 tchar (method and header name characters)
+    size_t scanToken(const char *data, size_t size);
+    // first control character other than HTAB, or DEL (ends a header value, CR included)
+    size_t scanValue(const char *data, size_t size);
+    // first byte <= 0x20 or DEL (ends the request target)
+    size_t scanTarget(const char *data, size_t size);
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <functional>
+#include "output.hpp"
+
+// Body of a response sent piece by piece with Transfer-Encoding: chunked (or,
+// for HTTP/1.0 clients, unframed and ended by closing the connection). A
+// handler that writes everything itself only goes through it while the handler
+// runs. With a producer the connection owns it after the handler returns, and
+// the I/O loop calls the producer again each time less than STREAM_WATERMARK
+// bytes are left queued, so output never runs far ahead of the socket.
+class ResponseStream
+{
+public:
+    // Writes some chunks and returns, or calls end(). Runs after the Request is
+    // gone, so it has to capture copies of whatever it needs from it.
+    using Producer = std::function<void(ResponseStream &)>;
+
+    Producer producer; // empty when the handler writes the whole body itself
+
+    ResponseStream(OutputQueue *out, bool chunked, bool headOnly);
+
+    void write(std::string_view chunk);
+    void write(std::string &&chunk); // from 1KB up the chunk becomes its own iovec, no copy
+    void trailer(std::string_view name, std::string_view value); // sent by end(), chunked only
+    void end();
+
+    bool ended() const { return finished; }
+    void retarget(OutputQueue *queue) { out = queue; } // an offloaded response continues on the connection's queue
+    size_t queued() const; // bytes of the connection's output the socket hasn't taken yet
+
+private:
+    OutputQueue *out;
+    bool chunked;
+    bool headOnly;
+    bool finished{false};
+    std::string trailers;
+
+    void emit(const char *data, size_t size);
+    void chunkHeader(size_t size);
+};
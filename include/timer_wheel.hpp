@@ -0,0 +1,97 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+// Intrusive timer, embedded in whatever owns the deadline. While armed it is
+// linked into one slot of a TimerWheel, so arming and cancelling never allocate.
+struct TimerNode
+{
+    TimerNode *prev{nullptr};
+    TimerNode *next{nullptr};
+    uint64_t expires{0}; // in wheel ticks
+    void *owner{nullptr}; // handed back to whoever handles the expiry
+
+    TimerNode() = default;
+    TimerNode(const TimerNode &) = delete;
+    TimerNode &operator=(const TimerNode &) = delete;
+    ~TimerNode() { unlink(); }
+
+    bool armed() const { return prev != nullptr; }
+    void unlink()
+    {
+        if (!prev)
+            return;
+        prev->next = next;
+        next->prev = prev;
+        prev = next = nullptr;
+    }
+};
+
+// Hierarchical timing wheel owned by one I/O loop thread. Level 0 has a slot
+// per tick, every level above it covers 64 times the span of the one below and
+// is cascaded down as the lower level wraps. Arm and cancel are O(1) list
+// splices; time comes from the coarse monotonic clock, read once per advance(),
+// so thousands of deadlines cost no syscall at all.
+class TimerWheel
+{
+public:
+    static const uint64_t TICK_MS = 10;
+    static const int SLOT_BITS = 6;
+    static const int SLOTS = 1 << SLOT_BITS;
+    static const int LEVELS = 4; // 2^24 ticks, about 46 hours at 10ms
+
+    TimerWheel();
+    ~TimerWheel();
+    TimerWheel(const TimerWheel &) = delete;
+    TimerWheel &operator=(const TimerWheel &) = delete;
+
+    // milliseconds on CLOCK_MONOTONIC_COARSE, a vDSO read
+    static uint64_t clock();
+
+    // (re)arms node to fire timeoutMs after the last advance(), cancelling any earlier deadline
+    void arm(TimerNode &node, uint64_t timeoutMs);
+    void cancel(TimerNode &node);
+    size_t size() const { return count; }
+
+    // how long the loop may sleep before the next advance() has work, -1 with nothing armed
+    int timeoutMs() const;
+
+    // Catches the wheel up with the clock and calls onExpire(node) for every timer
+    // that came due, already unlinked. The callback may arm or cancel any timer,
+    // including the one it was given.
+    template <typename F>
+    void advance(F &&onExpire)
+    {
+        nowMs = clock();
+        uint64_t target = nowMs / TICK_MS;
+        if (count == 0)
+        {
+            current = target + 1;
+            return;
+        }
+
+        TimerNode due;
+        due.prev = due.next = &due;
+        while (current <= target)
+        {
+            collect(due);
+            while (due.next != &due)
+            {
+                TimerNode *node = due.next;
+                node->unlink();
+                count--;
+                onExpire(*node);
+            }
+        }
+        due.unlink();
+    }
+
+private:
+    TimerNode slots[LEVELS][SLOTS]; // list heads, empty when pointing at themselves
+    uint64_t current{0};            // next tick to process
+    uint64_t nowMs{0};              // clock at the last advance(), what arm() counts from
+    size_t count{0};
+
+    void place(TimerNode &node);
+    void collect(TimerNode &due);
+};
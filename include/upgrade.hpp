@@ -0,0 +1,32 @@
+#pragma once
+#include <vector>
+#include <sys/types.h>
+
+// Zero-downtime binary upgrade. On SIGUSR2 the running server execs its binary
+// again (the new build, once a deploy has renamed it into place) with the same
+// arguments and passes it the listening sockets over a Unix socketpair with
+// SCM_RIGHTS. The listeners are never closed, so connections queued in their
+// backlogs are accepted by whichever process gets to them first. The old
+// process only stops accepting once the new one reports it is serving, then
+// drains its open connections and exits; if the new binary fails to come up
+// the old one just keeps going.
+namespace upgrade
+{
+    // Listeners handed over by the process being replaced, empty on a normal start.
+    // Call once, before opening any listener.
+    std::vector<int> inherit();
+
+    // Tells the replaced process we are accepting on the inherited listeners, no-op
+    // on a normal start.
+    void ready();
+
+    // Makes SIGUSR2 readable from requested(), works whichever thread the signal hits.
+    void watchSignal();
+
+    // Blocks until SIGUSR2 arrives.
+    void requested();
+
+    // Starts the new binary and hands it the listeners. Returns true once it
+    // reported ready within timeoutSeconds; on failure it is killed and reaped.
+    bool handOff(const std::vector<int> &listeners, int timeoutSeconds);
+}
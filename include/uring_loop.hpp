@@ -0,0 +1,122 @@
+#pragma once
+#include <linux/io_uring.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "event_loop.hpp"
+
+class Server;
+
+// Connection state plus the bookkeeping for operations still owned by the ring.
+struct UringConnection
+{
+    uint64_t id{0};
+    Connection conn;
+    bool sending{false}; // a send is in flight, the front output chunk must not move
+    bool closing{false}; // shutdown/close submitted, waiting for the close CQE
+    bool recvArmed{false};  // the multishot recv is still posting completions
+    bool recvPaused{false}; // recv cancelled while the read buffer is full and output is stuck
+
+    // gathered memory chunks of the in-flight sendmsg, the kernel reads them until it completes
+    iovec iov[OutputQueue::MAX_IOV];
+    msghdr msg{};
+
+    // file chunks are spliced file -> pipe -> socket, there is no sendfile opcode
+    int pipe[2]{-1, -1};
+    size_t pipeBytes{0};     // spliced in but not yet out to the socket
+    bool spliceFailed{false};
+
+    ~UringConnection()
+    {
+        if (pipe[0] >= 0)
+        {
+            close(pipe[0]);
+            close(pipe[1]);
+        }
+    }
+};
+
+// io_uring counterpart of EventLoop. One ring per thread, driven by a multishot
+// accept, multishot recv into a provided-buffer ring, and send linked with
+// shutdown/close when the connection ends. Talks to the kernel through the raw
+// syscalls so there is no liburing dependency.
+class UringLoop
+{
+public:
+    Server *server;
+    int ringfd{-1};
+    std::vector<int> listenfds;
+
+    TimerWheel timers; // deadlines of every connection below
+    OffloadMailbox mailbox; // responses of offloaded requests coming back from the scheduler
+    std::unordered_map<uint64_t, std::unique_ptr<UringConnection>> connections;
+
+    UringLoop(Server *server);
+    ~UringLoop();
+
+    bool init();            // false when the kernel lacks the features we need
+    void listenOn(int fd);  // call before run(), may be shared between loops and called more than once
+    void run();
+    void wake();            // thread-safe, run() then notices Server::draining
+
+private:
+    // ---- Submission and completion rings (mmap'd from the kernel)
+    unsigned *sqHead{nullptr};
+    unsigned *sqTail{nullptr};
+    unsigned sqMask{0};
+    unsigned sqEntries{0};
+    unsigned *sqArray{nullptr};
+    io_uring_sqe *sqes{nullptr};
+    unsigned *cqHead{nullptr};
+    unsigned *cqTail{nullptr};
+    unsigned cqMask{0};
+    io_uring_cqe *cqes{nullptr};
+    void *sqRing{nullptr};
+    void *cqRing{nullptr};
+    size_t sqRingSize{0};
+    size_t cqRingSize{0};
+    size_t sqesSize{0};
+    unsigned pendingSubmissions{0};
+
+    // ---- Provided receive buffers
+    io_uring_buf_ring *bufRing{nullptr};
+    size_t bufRingSize{0};
+    char *bufMemory{nullptr};
+    unsigned bufCount{0};
+    unsigned bufSize{0};
+
+    uint64_t nextId{1};
+    __kernel_timespec tick{}; // how long the pending OP_TICK waits, follows the wheel
+    uint64_t mailboxCount{0}; // eventfd counter read by the pending OP_OFFLOAD
+    bool draining{false};
+    bool drained{false}; // reported to the server, nothing left to serve
+
+    io_uring_sqe *getSqe();
+    bool submitAndWait(unsigned waitFor); // false on an error other than EINTR/EBUSY/EAGAIN
+    void recycleBuffer(unsigned bid);
+
+    void armAccept(size_t listener);
+    void armRecv(UringConnection &uc);
+    void pauseRecv(UringConnection &uc);
+    void resumeRecv(UringConnection &uc);
+    void armTick();
+    void armMailbox();
+    void submitSend(UringConnection &uc);
+    void submitSplice(UringConnection &uc);
+    void submitClose(UringConnection &uc);
+
+    void onAccept(size_t listener, int res, uint32_t flags);
+    void onRecv(UringConnection &uc, int res, uint32_t flags);
+    void onSend(UringConnection &uc, int res);
+    void onSpliceIn(UringConnection &uc, int res);
+    void onSpliceOut(UringConnection &uc, int res);
+    void afterSend(UringConnection &uc);
+    void processRequests(UringConnection &uc);
+    void onTimeout(UringConnection &uc);
+    void onOffloaded();
+    void drain();
+    void checkDrained();
+};
@@ -5,7 +5,7 @@
 
 using json = nlohmann::json;
 
-int main()
+int main(int argc, char **argv)
 {
     // Configure logger
     LoggerConfig logConfig;
@@ -17,7 +17,24 @@ int main()
 
     logger.info("Initializing HTTP Server...");
 
-    Server server(100, 3000);
+    // one event loop per core, each loop multiplexes thousands of connections
+    Server server(std::max(1u, std::thread::hardware_concurrency()), 3000);
+
+    // --- Accept mode: one SO_REUSEPORT listener per loop spreads accepts across cores
+    server.REUSE_PORT = true;
+
+    // --- I/O backend, pick with --backend=io_uring or --backend=epoll
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--backend=io_uring")
+            server.IO_BACKEND = IOBackend::IO_URING;
+        else if (arg == "--backend=epoll")
+            server.IO_BACKEND = IOBackend::EPOLL;
+    }
+
+    // --- Zero-downtime deploys: SIGUSR2 starts the binary on disk and hands it the listeners
+    server.HOT_UPGRADE = true;
 
     // --- Rate Limit Setting--- IP based rate limiting
     server.RateLimitEnabled = true;
@@ -0,0 +1,235 @@
+#include "asset_cache.hpp"
+#include "response.hpp"
+#include "logger.hpp"
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <cstdio>
+
+// startup only, so the levels favour size over speed; Brotli 11 gets slow past a megabyte
+static const int GZIP_LEVEL = 9;
+static const int BROTLI_LEVEL = 11;
+static const int BROTLI_LARGE_LEVEL = 9;
+static const size_t BROTLI_LARGE_FILE = 1024 * 1024;
+
+AssetCache::~AssetCache()
+{
+    for (auto &it : assets)
+    {
+        for (CachedAsset &variant : it.second.variants)
+        {
+            if (variant.fd >= 0)
+                close(variant.fd);
+        }
+    }
+}
+
+// regular files under directory up to maxFileSize, smallest first
+static std::vector<std::pair<size_t, std::string>> listFiles(const std::string &directory, size_t maxFileSize)
+{
+    namespace fs = std::filesystem;
+
+    std::vector<std::pair<size_t, std::string>> files;
+    for (const auto &entry : fs::directory_iterator(directory))
+    {
+        if (entry.is_regular_file() && entry.file_size() <= maxFileSize)
+            files.push_back({entry.file_size(), entry.path().filename().string()});
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+static bool readFile(const std::string &filepath, std::string &contents)
+{
+    std::ifstream in(filepath, std::ios::binary);
+    if (!in)
+        return false;
+    contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return true;
+}
+
+// an anonymous in-memory file holding data, -1 on failure
+static int memoryFile(const std::string &name, const std::string &data)
+{
+    int fd = memfd_create(name.c_str(), MFD_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    size_t written = 0;
+    while (written < data.size())
+    {
+        ssize_t n = write(fd, data.data() + written, data.size() - written);
+        if (n <= 0)
+        {
+            close(fd);
+            return -1;
+        }
+        written += n;
+    }
+    return fd;
+}
+
+std::string AssetCache::entityTag(const struct stat &st, Encoding encoding)
+{
+    char tag[96];
+    int length = snprintf(tag, sizeof(tag), "\"%lx-%lx-%lx%s%s\"", (unsigned long)st.st_ino, (unsigned long)st.st_size,
+                          (unsigned long)(st.st_mtim.tv_sec * 1000000000L + st.st_mtim.tv_nsec),
+                          encoding == Encoding::IDENTITY ? "" : "-", encoding == Encoding::IDENTITY ? "" : compression::token(encoding));
+    return std::string(tag, length);
+}
+
+std::string AssetCache::httpDate(time_t time)
+{
+    tm parts;
+    gmtime_r(&time, &parts);
+    char date[40];
+    size_t length = strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &parts);
+    return std::string(date, length);
+}
+
+void AssetCache::buildHeads(const std::string &filepath, AssetEntry &entry)
+{
+    std::string contentType = Response::getContentType(filepath);
+
+    struct stat st{};
+    bool validators = stat(filepath.c_str(), &st) == 0;
+
+    for (int i = 0; i < (int)Encoding::COUNT; i++)
+    {
+        if (!(entry.stored & (1u << i)))
+            continue;
+
+        CachedAsset &variant = entry.variants[i];
+        variant.contentType = contentType;
+        variant.encoding = (Encoding)i;
+        variant.head = "HTTP/1.1 " + Response::statusLine(200) + "\r\n" +
+                       "Content-Type: " + contentType + "\r\n" +
+                       "Content-Length: " + std::to_string(variant.size) + "\r\n" +
+                       "Accept-Ranges: bytes\r\n";
+        if (validators)
+        {
+            variant.etag = entityTag(st, (Encoding)i);
+            variant.lastModified = httpDate(st.st_mtime);
+            variant.modified = st.st_mtime;
+            variant.head += "ETag: " + variant.etag + "\r\n" + "Last-Modified: " + variant.lastModified + "\r\n";
+        }
+        if (i != (int)Encoding::IDENTITY)
+            variant.head += std::string("Content-Encoding: ") + compression::token((Encoding)i) + "\r\n";
+        if (entry.varies())
+            variant.head += "Vary: Accept-Encoding\r\n";
+    }
+}
+
+void AssetCache::load(const std::string &directory, size_t budget, size_t maxFileSize)
+{
+    // smallest first, so the budget covers as many files as possible
+    for (auto &file : listFiles(directory, maxFileSize))
+    {
+        std::string filepath = directory + "/" + file.second;
+        if (bytesUsed + file.first > budget)
+        {
+            logger.debug("Asset cache budget exhausted at " + filepath);
+            break;
+        }
+
+        AssetEntry &entry = assets[filepath];
+        CachedAsset &identity = entry.variants[(int)Encoding::IDENTITY];
+        if (!readFile(filepath, identity.body))
+        {
+            assets.erase(filepath);
+            continue;
+        }
+        identity.size = identity.body.size();
+        entry.stored |= 1u << (int)Encoding::IDENTITY;
+        buildHeads(filepath, entry);
+
+        bytesUsed += identity.size;
+    }
+
+    logger.info("Asset cache holds " + std::to_string(assets.size()) + " files (" + std::to_string(bytesUsed) + " bytes)");
+}
+
+void AssetCache::compress(const std::string &directory, size_t budget, size_t maxFileSize)
+{
+    if (!compression::available(Encoding::GZIP) && !compression::available(Encoding::BROTLI))
+    {
+        logger.info("Built without zlib and brotli, static files are served uncompressed");
+        return;
+    }
+
+    size_t variants = 0;
+    for (auto &file : listFiles(directory, maxFileSize))
+    {
+        std::string filepath = directory + "/" + file.second;
+        if (!compression::compressible(Response::getContentType(filepath)))
+            continue;
+
+        // cached files compress from memory and keep their variants there,
+        // the others are read once and their variants go to memfds
+        auto it = assets.find(filepath);
+        bool inMemory = it != assets.end();
+        std::string contents;
+        if (!inMemory && !readFile(filepath, contents))
+            continue;
+        const std::string &input = inMemory ? it->second.variants[(int)Encoding::IDENTITY].body : contents;
+
+        AssetEntry entry;
+        for (Encoding encoding : {Encoding::GZIP, Encoding::BROTLI})
+        {
+            int level = encoding == Encoding::GZIP ? GZIP_LEVEL : (input.size() > BROTLI_LARGE_FILE ? BROTLI_LARGE_LEVEL : BROTLI_LEVEL);
+            std::string output;
+            if (!compression::encode(encoding, input, output, level))
+                continue;
+
+            // a variant that saves less than a tenth isn't worth a Vary split in downstream caches
+            if (output.size() > input.size() - input.size() / 10)
+                continue;
+            if (compressedBytes + output.size() > budget)
+            {
+                logger.debug("Compression budget exhausted at " + filepath);
+                break;
+            }
+
+            CachedAsset &variant = entry.variants[(int)encoding];
+            variant.size = output.size();
+            if (inMemory)
+                variant.body = std::move(output);
+            else if ((variant.fd = memoryFile(file.second + "." + compression::token(encoding), output)) < 0)
+                continue;
+
+            entry.stored |= 1u << (int)encoding;
+            compressedBytes += variant.size;
+            variants++;
+        }
+
+        if (!entry.varies())
+            continue;
+        AssetEntry &target = assets[filepath];
+        for (Encoding encoding : {Encoding::GZIP, Encoding::BROTLI})
+            target.variants[(int)encoding] = std::move(entry.variants[(int)encoding]);
+        target.stored |= entry.stored;
+        buildHeads(filepath, target);
+    }
+
+    logger.info("Compressed " + std::to_string(variants) + " static variants (" + std::to_string(compressedBytes) + " bytes)");
+}
+
+const CachedAsset *AssetCache::select(const std::string &filepath, std::string_view acceptEncoding, bool &vary) const
+{
+    auto it = assets.find(filepath);
+    if (it == assets.end())
+    {
+        vary = false;
+        return nullptr;
+    }
+
+    const AssetEntry &entry = it->second;
+    vary = entry.varies();
+    Encoding encoding = vary ? compression::negotiate(acceptEncoding, entry.stored) : Encoding::IDENTITY;
+    if (!(entry.stored & (1u << (int)encoding)))
+        return nullptr; // identity of a file too large for memory
+    return &entry.variants[(int)encoding];
+}
@@ -0,0 +1,307 @@
+#include "compression.hpp"
+#include <strings.h>
+#include <time.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+namespace compression
+{
+    bool available(Encoding encoding)
+    {
+        switch (encoding)
+        {
+        case Encoding::IDENTITY:
+            return true;
+#ifdef HAVE_ZLIB
+        case Encoding::DEFLATE:
+        case Encoding::GZIP:
+            return true;
+#endif
+#ifdef HAVE_BROTLI
+        case Encoding::BROTLI:
+            return true;
+#endif
+        default:
+            return false;
+        }
+    }
+
+    const char *token(Encoding encoding)
+    {
+        switch (encoding)
+        {
+        case Encoding::DEFLATE:
+            return "deflate";
+        case Encoding::GZIP:
+            return "gzip";
+        case Encoding::BROTLI:
+            return "br";
+        default:
+            return "identity";
+        }
+    }
+
+    bool compressible(std::string_view contentType)
+    {
+        static const std::string_view types[] = {
+            "application/javascript", "application/json", "application/xml",
+            "application/manifest+json", "image/svg+xml"};
+
+        if (contentType.substr(0, 5) == "text/")
+            return true;
+        for (std::string_view type : types)
+        {
+            if (contentType.substr(0, type.size()) == type)
+                return true;
+        }
+        return false;
+    }
+
+    bool encode(Encoding encoding, std::string_view input, std::string &output, int level)
+    {
+#ifdef HAVE_ZLIB
+        if (encoding == Encoding::GZIP || encoding == Encoding::DEFLATE)
+        {
+            z_stream stream{};
+            // window bits 15 + 16 asks zlib for a gzip header and trailer
+            int windowBits = encoding == Encoding::GZIP ? 15 + 16 : 15;
+            if (deflateInit2(&stream, level, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+                return false;
+
+            output.resize(deflateBound(&stream, input.size()));
+            stream.next_in = (Bytef *)input.data();
+            stream.avail_in = input.size();
+            stream.next_out = (Bytef *)output.data();
+            stream.avail_out = output.size();
+
+            int result = deflate(&stream, Z_FINISH);
+            output.resize(stream.total_out);
+            deflateEnd(&stream);
+            return result == Z_STREAM_END;
+        }
+#endif
+#ifdef HAVE_BROTLI
+        if (encoding == Encoding::BROTLI)
+        {
+            size_t size = BrotliEncoderMaxCompressedSize(input.size());
+            output.resize(size ? size : input.size() + 1024);
+            if (!BrotliEncoderCompress(level, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, input.size(),
+                                       (const uint8_t *)input.data(), &size, (uint8_t *)output.data()))
+                return false;
+            output.resize(size);
+            return true;
+        }
+#endif
+        (void)input;
+        (void)output;
+        (void)level;
+        return false;
+    }
+
+    // q-value in thousandths, "1" and "1.000" are 1000, anything malformed is 0
+    static int parseQuality(std::string_view value)
+    {
+        if (value.empty() || (value[0] != '0' && value[0] != '1'))
+            return 0;
+        int quality = (value[0] - '0') * 1000;
+        if (value.size() > 1 && value[1] == '.')
+        {
+            int scale = 100;
+            for (size_t i = 2; i < value.size() && i < 5 && value[i] >= '0' && value[i] <= '9'; i++, scale /= 10)
+                quality += (value[i] - '0') * scale;
+        }
+        return quality > 1000 ? 1000 : quality;
+    }
+
+    static std::string_view trim(std::string_view value)
+    {
+        while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+            value.remove_prefix(1);
+        while (!value.empty() && (value.back() == ' ' || value.back() == '\t'))
+            value.remove_suffix(1);
+        return value;
+    }
+
+    Encoding negotiate(std::string_view acceptEncoding, unsigned offered)
+    {
+        const int UNSET = -1;
+        int quality[(int)Encoding::COUNT] = {UNSET, UNSET, UNSET, UNSET};
+        int wildcard = UNSET;
+
+        while (!acceptEncoding.empty())
+        {
+            size_t comma = acceptEncoding.find(',');
+            std::string_view item = acceptEncoding.substr(0, comma);
+            acceptEncoding = comma == std::string_view::npos ? std::string_view() : acceptEncoding.substr(comma + 1);
+
+            size_t semicolon = item.find(';');
+            std::string_view name = trim(item.substr(0, semicolon));
+            int q = 1000;
+            if (semicolon != std::string_view::npos)
+            {
+                std::string_view param = trim(item.substr(semicolon + 1));
+                if (param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=')
+                    q = parseQuality(param.substr(2));
+            }
+
+            if (name == "*")
+                wildcard = q;
+            else if (name.size() == 4 && strncasecmp(name.data(), "gzip", 4) == 0)
+                quality[(int)Encoding::GZIP] = q;
+            else if (name.size() == 6 && strncasecmp(name.data(), "x-gzip", 6) == 0)
+                quality[(int)Encoding::GZIP] = q;
+            else if (name.size() == 7 && strncasecmp(name.data(), "deflate", 7) == 0)
+                quality[(int)Encoding::DEFLATE] = q;
+            else if (name.size() == 2 && strncasecmp(name.data(), "br", 2) == 0)
+                quality[(int)Encoding::BROTLI] = q;
+            else if (name.size() == 8 && strncasecmp(name.data(), "identity", 8) == 0)
+                quality[(int)Encoding::IDENTITY] = q;
+        }
+
+        // later encodings win ties
+        Encoding best = Encoding::IDENTITY;
+        int bestQuality = 0;
+        for (int i = (int)Encoding::IDENTITY + 1; i < (int)Encoding::COUNT; i++)
+        {
+            int q = quality[i] != UNSET ? quality[i] : (wildcard != UNSET ? wildcard : 0);
+            if ((offered & (1u << i)) && q > 0 && q >= bestQuality)
+            {
+                best = (Encoding)i;
+                bestQuality = q;
+            }
+        }
+
+        // identity is always the fallback, it only beats a coding the client ranked lower
+        int identity = quality[(int)Encoding::IDENTITY];
+        if (best != Encoding::IDENTITY && identity > bestQuality)
+            return Encoding::IDENTITY;
+        return best;
+    }
+}
+
+// ---- Compressor
+
+static const long ADAPT_WINDOW_NS = 100 * 1000 * 1000;
+static const double SATURATED = 0.9; // share of the window the thread spent on CPU
+static const double HEADROOM = 0.6;
+
+static long nanoseconds(clockid_t clock)
+{
+    timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+Compressor::~Compressor()
+{
+#ifdef HAVE_ZLIB
+    for (z_stream_s *stream : streams)
+    {
+        if (stream)
+        {
+            deflateEnd(stream);
+            delete stream;
+        }
+    }
+#endif
+}
+
+// once per window, compares the thread's CPU time with the wall time that passed
+void Compressor::adapt()
+{
+    long now = nanoseconds(CLOCK_MONOTONIC_COARSE);
+    if (windowStart && now - windowStart < ADAPT_WINDOW_NS)
+        return;
+
+    long cpu = nanoseconds(CLOCK_THREAD_CPUTIME_ID);
+    if (windowStart)
+    {
+        double busy = (double)(cpu - windowCpu) / (now - windowStart);
+        if (busy > SATURATED && currentLevel > 1)
+            currentLevel--;
+        else if (busy < HEADROOM && currentLevel < maxLevel)
+            currentLevel++;
+    }
+    if (currentLevel > maxLevel)
+        currentLevel = maxLevel < 1 ? 1 : maxLevel;
+    windowStart = now;
+    windowCpu = cpu;
+}
+
+bool Compressor::begin(Encoding encoding)
+{
+#ifdef HAVE_ZLIB
+    if (encoding != Encoding::GZIP && encoding != Encoding::DEFLATE)
+        return false;
+    adapt();
+
+    int slot = encoding == Encoding::GZIP ? 1 : 0;
+    z_stream_s *&stream = streams[slot];
+    if (!stream)
+    {
+        stream = new z_stream{};
+        int windowBits = encoding == Encoding::GZIP ? 15 + 16 : 15;
+        if (deflateInit2(stream, currentLevel, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            delete stream;
+            stream = nullptr;
+            return false;
+        }
+        streamLevels[slot] = currentLevel;
+    }
+    else
+    {
+        deflateReset(stream);
+        // nothing is buffered right after a reset, so changing the level flushes nothing
+        if (streamLevels[slot] != currentLevel && deflateParams(stream, currentLevel, Z_DEFAULT_STRATEGY) == Z_OK)
+            streamLevels[slot] = currentLevel;
+    }
+    active = stream;
+    return true;
+#else
+    (void)encoding;
+    return false;
+#endif
+}
+
+bool Compressor::compress(std::string_view input, std::string &output)
+{
+#ifdef HAVE_ZLIB
+    if (!active)
+        return false;
+
+    active->next_in = (Bytef *)input.data();
+    active->avail_in = input.size();
+
+    // deflateBound of what's left is enough for one call to take all of it
+    int result;
+    do
+    {
+        size_t used = output.size();
+        size_t room = deflateBound(active, active->avail_in) + 64;
+        output.resize(used + room);
+        active->next_out = (Bytef *)output.data() + used;
+        active->avail_out = room;
+
+        result = deflate(active, Z_FINISH);
+        output.resize(used + room - active->avail_out);
+        if (result == Z_STREAM_ERROR)
+        {
+            active = nullptr;
+            return false;
+        }
+    } while (result != Z_STREAM_END);
+
+    active = nullptr;
+    return true;
+#else
+    (void)input;
+    (void)output;
+    return false;
+#endif
+}
@@ -0,0 +1,784 @@
+#include "event_loop.hpp"
+#include "server.hpp"
+#include "logger.hpp"
+#include "arena.hpp"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <algorithm>
+
+static const int MAX_EVENTS = 256;
+static const size_t READ_CHUNK = 16384;
+static const int ACCEPT_BATCH = 64;
+
+std::string peerAddress(int fd, PeerKey &key)
+{
+    // -- We have the connection, use that to get the IP
+    sockaddr_storage peeraddr{};
+    socklen_t peeraddr_len = sizeof(peeraddr);
+    getpeername(fd, (sockaddr *)&peeraddr, &peeraddr_len);
+    char ip[INET6_ADDRSTRLEN] = "";
+
+    if (peeraddr.ss_family == AF_INET6)
+    {
+        const in6_addr &addr = ((sockaddr_in6 *)&peeraddr)->sin6_addr;
+        memcpy(key.bytes, &addr, 16);
+        inet_ntop(AF_INET6, &addr, ip, sizeof(ip));
+    }
+    else
+    {
+        const in_addr &addr = ((sockaddr_in *)&peeraddr)->sin_addr;
+        memset(key.bytes, 0, 10);
+        key.bytes[10] = key.bytes[11] = 0xff;
+        memcpy(key.bytes + 12, &addr, 4);
+        inet_ntop(AF_INET, &addr, ip, sizeof(ip));
+    }
+    return ip;
+}
+
+EventLoop::EventLoop(Server *server) : server(server)
+{
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epfd < 0 || wakefd < 0)
+    {
+        logger.fatal("Failed to create event loop");
+        exit(1);
+    }
+
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = wakefd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev);
+
+    ev.data.fd = mailbox.fd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, mailbox.fd, &ev);
+}
+
+EventLoop::~EventLoop()
+{
+    for (auto &it : connections)
+    {
+        close(it.first);
+    }
+    for (int fd : listenfds)
+    {
+        close(fd);
+    }
+    close(wakefd);
+    close(epfd);
+}
+
+void EventLoop::addConnection(int fd)
+{
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        pending.push_back(fd);
+    }
+    wake();
+}
+
+void EventLoop::wake()
+{
+    uint64_t one = 1;
+    ssize_t ignored = write(wakefd, &one, sizeof(one));
+    (void)ignored;
+}
+
+void EventLoop::adoptPending()
+{
+    uint64_t count;
+    ssize_t ignored = read(wakefd, &count, sizeof(count));
+    (void)ignored;
+
+    std::vector<int> fds;
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        fds.swap(pending);
+    }
+
+    for (int fd : fds)
+    {
+        adopt(fd);
+    }
+}
+
+void EventLoop::adopt(int fd)
+{
+    auto conn = std::make_unique<Connection>();
+    conn->fd = fd;
+    conn->id = nextId++;
+    conn->mailbox = &mailbox;
+    conn->timer.owner = conn.get();
+
+    conn->ip = peerAddress(fd, conn->peer);
+
+    // edge triggered, so every handler below drains the socket until EAGAIN
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.fd = fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+        logger.error("Failed to register connection with epoll");
+        close(fd);
+        return;
+    }
+    armDeadline(server, timers, *conn);
+    connections[fd] = std::move(conn);
+    server->metrics.connectionOpened();
+}
+
+void EventLoop::listenOn(int fd)
+{
+    listenfds.push_back(fd);
+
+    // level triggered, so a batch cap never strands pending connections in the backlog
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+void EventLoop::acceptBatch(int listenfd)
+{
+    for (int i = 0; i < ACCEPT_BATCH; i++)
+    {
+        int connfd = accept4(listenfd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (connfd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                logger.error("Failed to accept connection");
+            return;
+        }
+        adopt(connfd);
+    }
+}
+
+void EventLoop::run()
+{
+    epoll_event events[MAX_EVENTS];
+    if (server->offloading)
+        server->scheduler.attach();
+
+    while (true)
+    {
+        // sleeps until the next deadline at most, forever with no connections
+        int n = epoll_wait(epfd, events, MAX_EVENTS, timers.timeoutMs());
+        if (n < 0 && errno != EINTR)
+        {
+            logger.error("epoll_wait failed");
+            continue;
+        }
+
+        // expire what came due while asleep, and give the handlers below a fresh clock to arm from
+        timers.advance([this](TimerNode &node) { onTimeout(*(Connection *)node.owner); });
+
+        for (int i = 0; i < n; i++)
+        {
+            int fd = events[i].data.fd;
+            uint32_t flags = events[i].events;
+
+            if (fd == wakefd)
+            {
+                adoptPending();
+                if (server->draining && !draining)
+                    drain();
+                continue;
+            }
+
+            if (std::find(listenfds.begin(), listenfds.end(), fd) != listenfds.end())
+            {
+                acceptBatch(fd);
+                continue;
+            }
+
+            if (fd == mailbox.fd)
+            {
+                onOffloaded();
+                continue;
+            }
+
+            auto it = connections.find(fd);
+            if (it == connections.end())
+                continue;
+            Connection &conn = *it->second;
+
+            if (flags & (EPOLLERR | EPOLLHUP))
+            {
+                closeConnection(conn);
+                continue;
+            }
+
+            // onWritable resumes reading itself, nothing else to do for this fd
+            bool stalled = false;
+            if (flags & EPOLLOUT && !conn.output.empty())
+                onWritable(conn);
+            else if (flags & (EPOLLIN | EPOLLRDHUP))
+            {
+                stalled = !conn.output.empty();
+                onReadable(conn);
+            }
+            else
+                continue;
+
+            // bytes from a peer that isn't reading its responses don't make it any less idle
+            if (connections.find(fd) != connections.end() && !(stalled && !conn.output.empty() && conn.timer.armed()))
+                armDeadline(server, timers, conn);
+        }
+    }
+}
+
+void EventLoop::onReadable(Connection &conn)
+{
+    size_t limit = server->REQUEST_HEADER_SIZE_LIMIT + server->REQUEST_BODY_SIZE_LIMIT;
+    char buffer[READ_CHUNK];
+
+    while (true)
+    {
+        // a response is still on its way out (unread by the peer, streaming or
+        // offloaded), leave the rest in the socket so TCP pushes back
+        if ((conn.busy() || !conn.output.empty()) && conn.readBuffer.size() >= limit)
+            return;
+
+        ssize_t bytes = recv(conn.fd, buffer, sizeof(buffer), 0);
+        if (bytes > 0)
+        {
+            conn.readBuffer.append(buffer, bytes);
+            if (server->METRICS)
+                conn.receivedAt = Metrics::now();
+
+            // don't let a fast sender grow the buffer without bound, consume what we have first
+            if (conn.readBuffer.size() < limit)
+                continue;
+
+            int fd = conn.fd;
+            processRequests(conn);
+            if (connections.find(fd) == connections.end() || conn.busy() || !conn.output.empty())
+                return; // closed, or waiting on EPOLLOUT or the scheduler, which resume us
+            continue;
+        }
+        if (bytes == 0)
+        {
+            conn.peerClosed = true;
+            break;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            break;
+
+        closeConnection(conn);
+        return;
+    }
+
+    processRequests(conn);
+}
+
+void EventLoop::onWritable(Connection &conn)
+{
+    int fd = conn.fd;
+    if (!flush(conn))
+        return;
+
+    // still blocked, wait for the next EPOLLOUT edge
+    if (!conn.output.empty())
+        return;
+
+    // output drained, pick up whatever was left unread or unprocessed meanwhile
+    if (connections.find(fd) != connections.end())
+        onReadable(conn);
+}
+
+// Request and Response state of the request being served on this thread,
+// reset in one step once its handler has returned
+static thread_local RequestArena arena;
+
+// Connection headers and per-server settings every response starts out with
+static void prepareResponse(Server *server, Response &response, bool closeAfterWrite, int requestCount, bool http10)
+{
+    response.assets = &server->assets;
+    response.compressMinSize = server->COMPRESSION_MIN_SIZE;
+    response.compressLevel = server->COMPRESSION_LEVEL;
+    response.http10 = http10;
+    if (closeAfterWrite)
+        response.setHTTPHeader("Connection", "close");
+    else
+    {
+        response.setHTTPHeader("Connection", "keep-alive");
+        response.setHTTPHeader("Keep-Alive", "timeout=" + std::to_string(server->CONNECTION_TIMEOUT) + ", max=" + std::to_string(server->CONNECTION_MAX_REQUESTS - requestCount + 1));
+    }
+}
+
+// Wraps up a streamed response once its handler returned. Returns true when a
+// producer still has to run, the stream has then moved to stream.
+static bool settleStream(Response &response, bool http10, bool &closeAfterWrite, std::unique_ptr<ResponseStream> &stream)
+{
+    if (!response.streaming)
+        return false;
+
+    // an unframed HTTP/1.0 body is delimited by the close
+    if (http10)
+        closeAfterWrite = true;
+    if (!response.streaming->producer)
+        response.streaming->end(); // the handler wrote everything but didn't end it
+    else if (!response.streaming->ended())
+    {
+        stream = std::move(response.streaming);
+        return true;
+    }
+    return false;
+}
+
+// Copies the parsed request out of the connection and queues it on the
+// scheduler. The parser still holds its spans, the caller resets it.
+static void offload(Server *server, Connection &conn, size_t consumed, bool closeAfterWrite, const RequestSample &sample)
+{
+    auto request = std::make_unique<OffloadedRequest>();
+    request->server = server;
+    request->mailbox = conn.mailbox;
+    request->connection = conn.id;
+    request->fd = conn.fd;
+    request->raw.assign(conn.readBuffer, 0, consumed);
+    request->parser = conn.parser; // spans are offsets, they hold in the copy
+    request->ip = conn.ip;
+    request->peer = conn.peer;
+    request->requestCount = conn.requestCount;
+    request->closeAfterWrite = closeAfterWrite;
+    request->sample = sample;
+    request->submittedAt = server->METRICS ? Metrics::now() : 0;
+
+    conn.offloaded = true;
+    server->scheduler.submit(request.release());
+}
+
+static bool serveRequest(Server *server, Connection &conn)
+{
+    RequestParser &parser = conn.parser;
+    parser.maxHeaderBytes = server->REQUEST_HEADER_SIZE_LIMIT;
+    parser.maxBodyBytes = server->REQUEST_BODY_SIZE_LIMIT;
+
+    // only the bytes that arrived since the last call get scanned
+    bool measure = server->METRICS;
+    uint64_t parseStart = measure ? Metrics::now() : 0;
+    ParseResult result = parser.parse(conn.readBuffer.data(), conn.readBuffer.size());
+    if (measure)
+        conn.parseNs += Metrics::now() - parseStart;
+
+    // wait for the rest of the request
+    if (result == ParseResult::INCOMPLETE)
+        return false;
+
+    RequestSample sample;
+    sample.route = server->router.size();
+    sample.parseNs = conn.parseNs;
+    sample.queueNs = parseStart > conn.receivedAt ? parseStart - conn.receivedAt : 0;
+    conn.parseNs = 0;
+    OutputQueue::Mark mark = conn.output.mark();
+
+    // ---- Malformed or over a limit, answer and drop the connection
+    if (result == ParseResult::ERROR)
+    {
+        Response response{conn.fd, conn.output, arena.get()};
+        response.setHTTPHeader("Connection", "close");
+        response.sendHTML("", parser.errorStatus);
+        if (measure)
+        {
+            sample.status = parser.errorStatus;
+            sample.bytesIn = conn.readBuffer.size();
+            sample.bytesOut = conn.output.bytesSince(mark);
+            server->metrics.record(sample);
+        }
+        conn.readBuffer.clear();
+        conn.closeAfterWrite = true;
+        return true;
+    }
+
+    Request request{conn.fd, parser, conn.readBuffer.data(), arena.get(), server->ZERO_COPY_REQUESTS};
+    if (request.zeroCopy)
+        request.view.ip = conn.ip;
+    else
+        request.data.ip.assign(conn.ip);
+    request.peer = conn.peer;
+    bool http10 = parser.http10;
+    size_t consumed = parser.messageLength();
+    sample.bytesIn = consumed;
+
+    conn.requestCount++;
+
+    // if connection set to close, finish writing and close it, else keep reading
+    bool closeAfterWrite = !parser.keepAlive() || conn.requestCount > server->CONNECTION_MAX_REQUESTS || server->draining;
+
+    // ---- Slow routes go to the scheduler, the connection waits for their response
+    if (server->offloading && server->offloaded(request))
+    {
+        offload(server, conn, consumed, closeAfterWrite, sample);
+        parser.reset();
+        conn.readBuffer.erase(0, consumed);
+        return true;
+    }
+    parser.reset();
+    if (closeAfterWrite)
+        conn.closeAfterWrite = true;
+
+    Response response{conn.fd, conn.output, arena.get()};
+    prepareResponse(server, response, conn.closeAfterWrite, conn.requestCount, http10);
+
+    uint64_t handlerStart = measure ? Metrics::now() : 0;
+    server->handle(request, response);
+    if (measure)
+    {
+        sample.handlerNs = Metrics::now() - handlerStart;
+        sample.route = request.route ? request.route->id : server->router.size();
+        sample.status = atoi(response.status.c_str());
+        sample.bytesOut = conn.output.bytesSince(mark);
+        server->metrics.record(sample);
+    }
+
+    if (settleStream(response, http10, conn.closeAfterWrite, conn.stream))
+        pumpStream(conn);
+
+    // only now, request views point into these bytes while the handler runs
+    conn.readBuffer.erase(0, consumed);
+    return true;
+}
+
+void pumpStream(Connection &conn)
+{
+    ResponseStream &stream = *conn.stream;
+    while (!stream.ended() && stream.queued() < STREAM_WATERMARK)
+    {
+        size_t before = stream.queued();
+        stream.producer(stream);
+
+        if (!stream.ended() && stream.queued() == before)
+        {
+            // nothing queued means no write completion will ever call it again
+            if (conn.output.empty())
+            {
+                logger.warn("Streamed response producer wrote nothing, ending the response");
+                stream.end();
+            }
+            break;
+        }
+    }
+    if (stream.ended())
+        conn.stream.reset();
+}
+
+bool serveNext(Server *server, Connection &conn)
+{
+    // the Request and Response are gone by now, nothing points into the arena
+    bool served = serveRequest(server, conn);
+    arena.reset();
+    if (served)
+        conn.deadline = Deadline::IDLE; // the next request gets deadlines of its own
+    return served;
+}
+
+void OffloadedRequest::run()
+{
+    {
+        Request request{fd, parser, raw.data(), arena.get(), server->ZERO_COPY_REQUESTS};
+        if (request.zeroCopy)
+            request.view.ip = ip;
+        else
+            request.data.ip.assign(ip);
+        request.peer = peer;
+
+        Response response{fd, output, arena.get()};
+        prepareResponse(server, response, closeAfterWrite, requestCount, parser.http10);
+
+        // the time spent on the scheduler counts as queue wait
+        uint64_t handlerStart = server->METRICS ? Metrics::now() : 0;
+        server->handle(request, response);
+        if (server->METRICS)
+        {
+            if (submittedAt)
+                sample.queueNs += handlerStart - submittedAt;
+            sample.handlerNs = Metrics::now() - handlerStart;
+            sample.route = request.route ? request.route->id : server->router.size();
+            sample.status = atoi(response.status.c_str());
+            sample.bytesOut = output.bytesSince({});
+            server->metrics.record(sample);
+        }
+        settleStream(response, parser.http10, closeAfterWrite, stream);
+    }
+    arena.reset();
+    mailbox->post(this);
+}
+
+OffloadMailbox::OffloadMailbox()
+{
+    fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0)
+    {
+        logger.fatal("Failed to create offload mailbox");
+        exit(1);
+    }
+}
+
+OffloadMailbox::~OffloadMailbox()
+{
+    for (OffloadedRequest *request : done)
+    {
+        delete request;
+    }
+    close(fd);
+}
+
+void OffloadMailbox::post(OffloadedRequest *request)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done.push_back(request);
+    }
+    uint64_t one = 1;
+    ssize_t ignored = write(fd, &one, sizeof(one));
+    (void)ignored;
+}
+
+std::vector<std::unique_ptr<OffloadedRequest>> OffloadMailbox::take()
+{
+    uint64_t count;
+    ssize_t ignored = read(fd, &count, sizeof(count));
+    (void)ignored;
+
+    std::vector<OffloadedRequest *> taken;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        taken.swap(done);
+    }
+
+    std::vector<std::unique_ptr<OffloadedRequest>> requests;
+    for (OffloadedRequest *request : taken)
+    {
+        requests.emplace_back(request);
+    }
+    return requests;
+}
+
+void finishOffloaded(Connection &conn, OffloadedRequest &request)
+{
+    conn.offloaded = false;
+    conn.output.splice(request.output);
+    if (request.closeAfterWrite)
+        conn.closeAfterWrite = true;
+    if (request.stream)
+    {
+        request.stream->retarget(&conn.output);
+        conn.stream = std::move(request.stream);
+    }
+}
+
+bool requestTimedOut(Connection &conn)
+{
+    if (conn.deadline == Deadline::IDLE)
+        return false;
+
+    {
+        Response response{conn.fd, conn.output, arena.get()};
+        response.setHTTPHeader("Connection", "close");
+        response.sendHTML("", 408);
+    }
+    arena.reset();
+
+    conn.readBuffer.clear();
+    conn.parser.reset();
+    conn.closeAfterWrite = true;
+    return true;
+}
+
+void armDeadline(Server *server, TimerWheel &timers, Connection &conn)
+{
+    // the handler's time is ours, not the client's
+    if (conn.offloaded)
+    {
+        timers.cancel(conn.timer);
+        return;
+    }
+
+    Deadline deadline = Deadline::IDLE;
+    if (conn.output.empty() && !conn.stream && !conn.readBuffer.empty())
+        deadline = conn.parser.inBody() ? Deadline::BODY : Deadline::HEADER;
+
+    // more bytes of the same request don't buy it more time
+    if (deadline == conn.deadline && deadline != Deadline::IDLE && conn.timer.armed())
+        return;
+
+    conn.deadline = deadline;
+    int seconds = deadline == Deadline::HEADER ? server->HEADER_TIMEOUT
+                  : deadline == Deadline::BODY ? server->BODY_TIMEOUT
+                                               : server->CONNECTION_TIMEOUT;
+
+    // draining for an upgrade: a keep-alive connection with nothing in flight goes now,
+    // one that was never served gets its first request in
+    if (server->draining && deadline == Deadline::IDLE && conn.requestCount > 0 && conn.output.empty() && !conn.stream)
+        seconds = 0;
+    timers.arm(conn.timer, (uint64_t)seconds * 1000);
+}
+
+void EventLoop::processRequests(Connection &conn)
+{
+    while (!conn.closeAfterWrite && conn.output.empty())
+    {
+        // answer every complete request already buffered, then write all of it with one sendmsg
+        int served = 0;
+        while (served < PIPELINE_BATCH && !conn.closeAfterWrite && !conn.busy() && serveNext(server, conn))
+            served++;
+
+        if (served == 0)
+            break;
+        // a stream that held the rest back may finish within this flush, nothing else wakes us for them
+        bool heldBack = conn.busy();
+        if (!flush(conn))
+            return;
+        if (served < PIPELINE_BATCH && !heldBack)
+            break;
+    }
+
+    // the peer is gone and everything it asked for has been written
+    if (conn.peerClosed && conn.output.empty() && !conn.offloaded)
+        closeConnection(conn);
+}
+
+// Writes as much of the pending output as the socket accepts. Returns false when
+// the connection was closed in the process.
+bool EventLoop::flush(Connection &conn)
+{
+    OutputQueue &out = conn.output;
+
+    while (true)
+    {
+        // a streamed response refills the queue as the socket takes it
+        if (conn.stream && out.pending() < STREAM_WATERMARK)
+            pumpStream(conn);
+        if (out.empty())
+            break;
+
+        OutputChunk &chunk = out.chunks.front();
+        ssize_t sent;
+
+        if (chunk.isFile())
+        {
+            // zero copy, the page cache goes straight to the socket
+            sent = sendfile(conn.fd, chunk.fileFd, &chunk.fileOffset, chunk.fileRemaining);
+            if (sent == 0)
+            {
+                // the file shrank after we announced its length, the response can't be completed
+                closeConnection(conn);
+                return false;
+            }
+            if (sent > 0)
+            {
+                chunk.fileRemaining -= sent;
+                if (chunk.fileRemaining == 0)
+                    out.popFront();
+            }
+        }
+        else
+        {
+            // every queued memory chunk in one syscall, cached assets are never copied
+            iovec iov[OutputQueue::MAX_IOV];
+            msghdr msg{};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = out.gather(iov, OutputQueue::MAX_IOV);
+
+            // MSG_MORE holds headers back so they share a segment with the file data behind them
+            int flags = MSG_NOSIGNAL | (msg.msg_iovlen < out.chunks.size() ? MSG_MORE : 0);
+            sent = sendmsg(conn.fd, &msg, flags);
+            if (sent > 0)
+                out.consume(sent);
+        }
+
+        if (sent > 0)
+            continue;
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return true; // the next EPOLLOUT edge picks this up
+
+        closeConnection(conn);
+        return false;
+    }
+
+    if (conn.closeAfterWrite)
+    {
+        closeConnection(conn);
+        return false;
+    }
+    return true;
+}
+
+void EventLoop::closeConnection(Connection &conn)
+{
+    int fd = conn.fd;
+    logger.debug("Closing the Connection for IP: " + conn.ip);
+    timers.cancel(conn.timer);
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    connections.erase(fd);
+    server->metrics.connectionClosed();
+    if (draining)
+        checkDrained();
+}
+
+// The new process accepts from now on. The listeners stay open, it shares them,
+// so they are only taken out of this loop's epoll set.
+void EventLoop::drain()
+{
+    draining = true;
+    for (int fd : listenfds)
+    {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+    }
+    listenfds.clear();
+
+    for (auto &it : connections)
+    {
+        armDeadline(server, timers, *it.second);
+    }
+    checkDrained();
+}
+
+void EventLoop::checkDrained()
+{
+    if (drained || !connections.empty())
+        return;
+    drained = true;
+    server->loopDrained();
+}
+
+void EventLoop::onOffloaded()
+{
+    for (auto &request : mailbox.take())
+    {
+        auto it = connections.find(request->fd);
+        if (it == connections.end() || it->second->id != request->connection)
+            continue; // closed while the handler ran
+        Connection &conn = *it->second;
+
+        // write it out, then carry on with whatever the client pipelined behind it
+        finishOffloaded(conn, *request);
+        onWritable(conn);
+        if (connections.find(request->fd) != connections.end())
+            armDeadline(server, timers, conn);
+    }
+}
+
+void EventLoop::onTimeout(Connection &conn)
+{
+    logger.debug("Connection timed out for IP: " + conn.ip);
+    if (!requestTimedOut(conn))
+    {
+        closeConnection(conn);
+        return;
+    }
+
+    // the 408 closes the connection once written, a peer that never reads it hits the idle deadline
+    if (flush(conn))
+        armDeadline(server, timers, conn);
+}
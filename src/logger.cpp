@@ -1,4 +1,208 @@
 #include "logger.hpp"
+#include <chrono>
 
 // Global logger instance
 Logger logger;
+
+static const auto WRITER_INTERVAL = std::chrono::milliseconds(10);
+
+bool LogRing::push(LogRecord &&record)
+{
+    size_t t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) > mask)
+    {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    slots[t & mask] = std::move(record);
+    tail.store(t + 1, std::memory_order_release);
+    logged.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+// the writer starts last, once every member it reads is constructed
+Logger::Logger()
+{
+    writer = std::thread(&Logger::writerLoop, this);
+}
+
+Logger::Logger(LoggerConfig cfg) : config(cfg)
+{
+    if (config.logToFile)
+    {
+        fileStream.open(config.logFilePath, std::ios::app);
+    }
+    writer = std::thread(&Logger::writerLoop, this);
+}
+
+Logger::~Logger()
+{
+    stopping.store(true, std::memory_order_release);
+    if (writer.joinable())
+        writer.join();
+
+    if (fileStream.is_open())
+    {
+        fileStream.close();
+    }
+}
+
+// The calling thread's queue, created and published on its first log line
+LogRing *Logger::threadRing()
+{
+    thread_local LogRing *ring = nullptr;
+    if (ring)
+        return ring;
+
+    size_t capacity = 1;
+    while (capacity < config.queueCapacity)
+        capacity <<= 1;
+
+    ring = new LogRing();
+    ring->slots.resize(capacity);
+    ring->mask = capacity - 1;
+
+    // lock-free push on the list the writer walks
+    LogRing *head = rings.load(std::memory_order_relaxed);
+    do
+    {
+        ring->next = head;
+    } while (!rings.compare_exchange_weak(head, ring, std::memory_order_release, std::memory_order_relaxed));
+
+    return ring;
+}
+
+void Logger::writeLog(LogLevel level, std::string message)
+{
+    if (level < config.minLevel)
+        return;
+
+    threadRing()->push({level, std::time(nullptr), std::move(message)});
+}
+
+const char *Logger::getTimestamp(time_t now)
+{
+    if (now != cachedTime)
+    {
+        struct tm tm;
+        localtime_r(&now, &tm);
+        strftime(cachedTimestamp, sizeof(cachedTimestamp), "%Y-%m-%d %H:%M:%S", &tm);
+        cachedTime = now;
+    }
+    return cachedTimestamp;
+}
+
+void Logger::format(const LogRecord &record, std::string &console, std::string &file)
+{
+    std::string plain;
+
+    // Build log line
+    if (config.showTimestamp)
+    {
+        const char *timestamp = getTimestamp(record.time);
+        plain += "[";
+        plain += timestamp;
+        plain += "] ";
+        if (config.showColors)
+            console += GRAY + "[" + timestamp + "] " + RESET;
+        else
+            console += "[" + std::string(timestamp) + "] ";
+    }
+
+    if (config.showLevel)
+    {
+        plain += "[" + getLevelString(record.level) + "] ";
+        if (config.showColors)
+            console += getLevelColor(record.level) + "[" + getLevelString(record.level) + "]" + RESET + " ";
+        else
+            console += "[" + getLevelString(record.level) + "] ";
+    }
+
+    console += record.message;
+    console += '\n';
+
+    if (config.logToFile)
+    {
+        file += plain;
+        file += record.message;
+        file += '\n';
+    }
+}
+
+// Empties every thread's queue into one batch per output. Lines keep their
+// order within a thread, lines of different threads are grouped per thread.
+// Returns false when there was nothing to write.
+bool Logger::drain()
+{
+    std::lock_guard<std::mutex> lock(configMutex);
+    std::string console;
+    std::string file;
+    uint64_t count = 0;
+    uint64_t dropped = 0;
+
+    for (LogRing *ring = rings.load(std::memory_order_acquire); ring; ring = ring->next)
+    {
+        size_t h = ring->head.load(std::memory_order_relaxed);
+        size_t t = ring->tail.load(std::memory_order_acquire);
+
+        for (; h != t; h++)
+        {
+            LogRecord &record = ring->slots[h & ring->mask];
+            format(record, console, file);
+            record.message.clear();
+            count++;
+        }
+        ring->head.store(h, std::memory_order_release);
+        dropped += ring->dropped.load(std::memory_order_relaxed);
+    }
+
+    // say so when lines were lost, once per batch
+    if (dropped != droppedReported)
+    {
+        LogRecord notice{LogLevel::WARN, std::time(nullptr),
+                         "Logger queue full, dropped " + std::to_string(dropped - droppedReported) + " lines"};
+        format(notice, console, file);
+        droppedReported = dropped;
+        count++;
+    }
+
+    if (count == 0)
+        return false;
+
+    // Output to console
+    std::cout.write(console.data(), console.size());
+    std::cout.flush();
+
+    // Output to file
+    if (config.logToFile && fileStream.is_open())
+    {
+        fileStream.write(file.data(), file.size());
+        fileStream.flush();
+    }
+
+    written.fetch_add(count, std::memory_order_relaxed);
+    return true;
+}
+
+void Logger::writerLoop()
+{
+    // one batched write per interval, queues are sized to absorb the lines in between
+    while (!stopping.load(std::memory_order_acquire))
+    {
+        drain();
+        std::this_thread::sleep_for(WRITER_INTERVAL);
+    }
+    drain();
+}
+
+LoggerStats Logger::stats()
+{
+    LoggerStats result{0, 0, written.load(std::memory_order_relaxed)};
+    for (LogRing *ring = rings.load(std::memory_order_acquire); ring; ring = ring->next)
+    {
+        result.logged += ring->logged.load(std::memory_order_relaxed);
+        result.dropped += ring->dropped.load(std::memory_order_relaxed);
+    }
+    return result;
+}
@@ -0,0 +1,322 @@
+#include "metrics.hpp"
+#include "router.hpp"
+#include "logger.hpp"
+#include <vector>
+#include <cstdio>
+
+// the slot of the calling thread, set by local()
+static thread_local WorkerMetrics *ownSlot = nullptr;
+
+// Prometheus bucket bounds the HDR buckets are folded into on a scrape
+static const struct
+{
+    const char *label;
+    uint64_t ns;
+} BOUNDS[] = {
+    {"0.000001", 1000}, {"0.0000025", 2500}, {"0.000005", 5000}, {"0.00001", 10000},
+    {"0.000025", 25000}, {"0.00005", 50000}, {"0.0001", 100000}, {"0.00025", 250000},
+    {"0.0005", 500000}, {"0.001", 1000000}, {"0.0025", 2500000}, {"0.005", 5000000},
+    {"0.01", 10000000}, {"0.025", 25000000}, {"0.05", 50000000}, {"0.1", 100000000},
+    {"0.25", 250000000}, {"0.5", 500000000}, {"1", 1000000000}, {"2.5", 2500000000},
+    {"5", 5000000000}, {"10", 10000000000},
+};
+
+// only the owning thread writes, so a plain load and store is enough and no
+// locked instruction is needed
+static void add(std::atomic<uint64_t> &counter, uint64_t value)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+int LatencyHistogram::bucketOf(uint64_t ns)
+{
+    if (ns < (uint64_t)SUB_BUCKETS)
+        return (int)ns;
+    if (ns >> MAX_BITS)
+        return BUCKETS - 1;
+
+    // the top SUB_BITS + 1 bits pick the bucket, the leading one picks the power of two
+    int msb = 63 - __builtin_clzll(ns);
+    int shift = msb - SUB_BITS;
+    return (shift + 1) * SUB_BUCKETS + (int)((ns >> shift) & (SUB_BUCKETS - 1));
+}
+
+uint64_t LatencyHistogram::upperBound(int bucket)
+{
+    if (bucket < SUB_BUCKETS)
+        return bucket;
+    int shift = bucket / SUB_BUCKETS - 1;
+    uint64_t lower = (uint64_t)(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+    return lower + ((uint64_t)1 << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t ns)
+{
+    add(counts[bucketOf(ns)], 1);
+    add(sum, ns);
+}
+
+// Threads index their slots by route id, so the route count can't change under them
+void Metrics::configure(size_t routeCount)
+{
+    if (configured || workerCount.load() > 0)
+    {
+        logger.fatal("Metrics configured twice or after recording started");
+        exit(1);
+    }
+    configured = true;
+    routeSlots = routeCount + 1;
+}
+
+// Slots are never freed, like the detached threads that own them they live as
+// long as the process.
+WorkerMetrics &Metrics::local()
+{
+    if (ownSlot && ownSlot->owner == this)
+        return *ownSlot;
+
+    int index = workerCount.fetch_add(1);
+    if (index >= MAX_WORKERS)
+    {
+        logger.fatal("Metrics support at most " + std::to_string(MAX_WORKERS) + " threads");
+        exit(1);
+    }
+    WorkerMetrics *slot = new WorkerMetrics();
+    slot->owner = this;
+    slot->routes.reset(new std::atomic<RouteStats *>[routeSlots]{});
+
+    // a scrape running meanwhile skips the entry until it is published
+    workers[index].store(slot, std::memory_order_release);
+    ownSlot = slot;
+    return *slot;
+}
+
+void Metrics::record(const RequestSample &sample)
+{
+    WorkerMetrics &worker = local();
+    std::atomic<RouteStats *> &slot = worker.routes[sample.route < routeSlots ? sample.route : routeSlots - 1];
+
+    // most threads serve a few routes only, the others never cost a histogram
+    RouteStats *entry = slot.load(std::memory_order_relaxed);
+    if (!entry)
+    {
+        entry = new RouteStats();
+        slot.store(entry, std::memory_order_release);
+    }
+    RouteStats &stats = *entry;
+
+    add(stats.requests, 1);
+    if (sample.status >= 100 && sample.status < 600)
+        add(stats.statusClasses[sample.status / 100 - 1], 1);
+    add(stats.bytesIn, sample.bytesIn);
+    add(stats.bytesOut, sample.bytesOut);
+    stats.parse.record(sample.parseNs);
+    stats.handler.record(sample.handlerNs);
+    stats.queueWait.record(sample.queueNs);
+}
+
+void Metrics::connectionOpened()
+{
+    add(local().connectionsOpened, 1);
+}
+
+void Metrics::connectionClosed()
+{
+    add(local().connectionsClosed, 1);
+}
+
+// ---- Scrape
+
+namespace
+{
+    struct MergedHistogram
+    {
+        std::vector<uint64_t> counts = std::vector<uint64_t>(LatencyHistogram::BUCKETS);
+        uint64_t sum{0};
+        uint64_t total{0};
+
+        void merge(const LatencyHistogram &histogram)
+        {
+            for (int i = 0; i < LatencyHistogram::BUCKETS; i++)
+            {
+                uint64_t count = histogram.counts[i].load(std::memory_order_relaxed);
+                counts[i] += count;
+                total += count;
+            }
+            sum += histogram.sum.load(std::memory_order_relaxed);
+        }
+    };
+
+    struct MergedRoute
+    {
+        uint64_t requests{0};
+        uint64_t statusClasses[5]{};
+        uint64_t bytesIn{0};
+        uint64_t bytesOut{0};
+        MergedHistogram parse;
+        MergedHistogram handler;
+        MergedHistogram queueWait;
+    };
+}
+
+static std::string escapeLabel(const std::string &value)
+{
+    std::string escaped;
+    for (char c : value)
+    {
+        if (c == '\\' || c == '"')
+            escaped += '\\';
+        if (c == '\n')
+        {
+            escaped += "\\n";
+            continue;
+        }
+        escaped += c;
+    }
+    return escaped;
+}
+
+static std::string seconds(uint64_t ns)
+{
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.9f", ns / 1e9);
+    return buffer;
+}
+
+static void header(std::string &out, const char *name, const char *type, const char *help)
+{
+    out += "# HELP ";
+    out += name;
+    out += ' ';
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += ' ';
+    out += type;
+    out += '\n';
+}
+
+// Folds the HDR buckets into the fixed Prometheus bounds. An HDR bucket counts
+// towards a bound once all of it is at or below it, so a bucket is off by at
+// most one HDR sub-bucket width.
+static void histogram(std::string &out, const char *name, const std::string &labels, const MergedHistogram &merged)
+{
+    uint64_t cumulative = 0;
+    int bucket = 0;
+    for (const auto &bound : BOUNDS)
+    {
+        while (bucket < LatencyHistogram::BUCKETS && LatencyHistogram::upperBound(bucket) <= bound.ns)
+            cumulative += merged.counts[bucket++];
+        out += name;
+        out += "_bucket{" + labels + ",le=\"" + bound.label + "\"} " + std::to_string(cumulative) + '\n';
+    }
+    out += name;
+    out += "_bucket{" + labels + ",le=\"+Inf\"} " + std::to_string(merged.total) + '\n';
+    out += name;
+    out += "_sum{" + labels + "} " + seconds(merged.sum) + '\n';
+    out += name;
+    out += "_count{" + labels + "} " + std::to_string(merged.total) + '\n';
+}
+
+std::string Metrics::render(const Router &router) const
+{
+    std::vector<MergedRoute> routes(routeSlots);
+    uint64_t opened = 0;
+    uint64_t closed = 0;
+
+    int count = workerCount.load(std::memory_order_acquire);
+    for (int w = 0; w < count && w < MAX_WORKERS; w++)
+    {
+        const WorkerMetrics *worker = workers[w].load(std::memory_order_acquire);
+        if (!worker)
+            continue;
+        opened += worker->connectionsOpened.load(std::memory_order_relaxed);
+        closed += worker->connectionsClosed.load(std::memory_order_relaxed);
+
+        for (size_t r = 0; r < routeSlots; r++)
+        {
+            const RouteStats *entry = worker->routes[r].load(std::memory_order_acquire);
+            if (!entry)
+                continue; // never served on this thread
+            const RouteStats &stats = *entry;
+            uint64_t requests = stats.requests.load(std::memory_order_relaxed);
+            MergedRoute &merged = routes[r];
+            merged.requests += requests;
+            for (int c = 0; c < 5; c++)
+            {
+                merged.statusClasses[c] += stats.statusClasses[c].load(std::memory_order_relaxed);
+            }
+            merged.bytesIn += stats.bytesIn.load(std::memory_order_relaxed);
+            merged.bytesOut += stats.bytesOut.load(std::memory_order_relaxed);
+            merged.parse.merge(stats.parse);
+            merged.handler.merge(stats.handler);
+            merged.queueWait.merge(stats.queueWait);
+        }
+    }
+
+    // method and pattern of every route that served anything
+    std::vector<std::string> labels(routeSlots);
+    for (size_t r = 0; r < routeSlots; r++)
+    {
+        if (r + 1 == routeSlots || r >= router.size())
+            labels[r] = "method=\"\",route=\"unmatched\"";
+        else
+        {
+            const RouteEntry &entry = router.entry(r);
+            labels[r] = "method=\"" + escapeLabel(entry.method) + "\",route=\"" + escapeLabel(entry.pattern) + "\"";
+        }
+    }
+
+    std::string out;
+    out.reserve(4096);
+
+    header(out, "http_connections_active", "gauge", "Client connections currently open.");
+    out += "http_connections_active " + std::to_string(opened >= closed ? opened - closed : 0) + '\n';
+    header(out, "http_connections_total", "counter", "Client connections accepted.");
+    out += "http_connections_total " + std::to_string(opened) + '\n';
+
+    header(out, "http_requests_total", "counter", "Requests served, by route pattern and status class.");
+    for (size_t r = 0; r < routeSlots; r++)
+    {
+        for (int c = 0; c < 5; c++)
+        {
+            if (routes[r].statusClasses[c] == 0)
+                continue;
+            out += "http_requests_total{" + labels[r] + ",code=\"" + std::to_string(c + 1) + "xx\"} " +
+                   std::to_string(routes[r].statusClasses[c]) + '\n';
+        }
+    }
+
+    header(out, "http_request_bytes_total", "counter", "Request bytes received, headers included.");
+    for (size_t r = 0; r < routeSlots; r++)
+    {
+        if (routes[r].requests)
+            out += "http_request_bytes_total{" + labels[r] + "} " + std::to_string(routes[r].bytesIn) + '\n';
+    }
+    header(out, "http_response_bytes_total", "counter", "Response bytes queued by handlers, streamed bodies only as far as the handler wrote them.");
+    for (size_t r = 0; r < routeSlots; r++)
+    {
+        if (routes[r].requests)
+            out += "http_response_bytes_total{" + labels[r] + "} " + std::to_string(routes[r].bytesOut) + '\n';
+    }
+
+    header(out, "http_request_parse_seconds", "histogram", "Time spent parsing the request.");
+    for (size_t r = 0; r < routeSlots; r++)
+    {
+        if (routes[r].requests)
+            histogram(out, "http_request_parse_seconds", labels[r], routes[r].parse);
+    }
+    header(out, "http_request_handler_seconds", "histogram", "Time spent in middlewares and the route handler.");
+    for (size_t r = 0; r < routeSlots; r++)
+    {
+        if (routes[r].requests)
+            histogram(out, "http_request_handler_seconds", labels[r], routes[r].handler);
+    }
+    header(out, "http_request_queue_seconds", "histogram", "Time a complete request waited before it was served.");
+    for (size_t r = 0; r < routeSlots; r++)
+    {
+        if (routes[r].requests)
+            histogram(out, "http_request_queue_seconds", labels[r], routes[r].queueWait);
+    }
+    return out;
+}
@@ -3,22 +3,38 @@
 
 using json = nlohmann::json;
 
+static int hexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
 // --- URL Decoder Middleware
 void urlDecode(Request &req, Response &res, Next next)
 {
-    std::string decodedString;
+    // views are decoded while the request is built
+    if (req.zeroCopy)
+    {
+        next();
+        return;
+    }
 
-    for (int i = 0; i < req.data.path.size(); i++)
+    std::pmr::string decodedString(req.data.path.get_allocator());
+
+    for (size_t i = 0; i < req.data.path.size(); i++)
     {
         char x = req.data.path[i];
 
         if (x == '+')
             decodedString += " ";
-        else if (x == '%' && i + 2 < req.data.path.size())
+        else if (x == '%' && i + 2 < req.data.path.size() && hexValue(req.data.path[i + 1]) >= 0 && hexValue(req.data.path[i + 2]) >= 0)
         {
-            std::string hex = req.data.path.substr(i+1, 2);
-            int ascii = std::stoi(hex, nullptr, 16);
-            decodedString += static_cast<char>(ascii);
+            decodedString += static_cast<char>(hexValue(req.data.path[i + 1]) * 16 + hexValue(req.data.path[i + 2]));
 
             i += 2;
         }
@@ -27,11 +43,16 @@ void urlDecode(Request &req, Response &res, Next next)
         }
     }
 
-    req.data.path = decodedString;
+    req.data.path = std::move(decodedString);
     next();
 }
 
 void paramExtractor(Request &req, Response &res, Next next){
+    if (req.zeroCopy) {
+        next();
+        return;
+    }
+
     size_t qm = req.data.path.find('?');
 
     if (qm == req.data.path.npos) {
@@ -39,40 +60,28 @@ void paramExtractor(Request &req, Response &res, Next next){
         return;
     }
 
-    std::string queryString = req.data.path.substr(qm+1, req.data.path.size() - qm - 1);
-    size_t ampPos = queryString.find_first_of('&', 0);
-    
-    // update the path without the query param 
-    req.data.path  = req.data.path.substr(0, qm);
+    std::string_view queryString = std::string_view(req.data.path).substr(qm + 1);
 
-    int i = 0;
+    size_t i = 0;
     while ( i < queryString.length()){
-        char x = queryString[i]; 
-        // std::cout << x << "\n";
-        
-        std::string key; 
-        std::string value; 
-        
         // find the next & : key=value&key=value
-        ampPos = queryString.find_first_of('&', i);
-
-        if (ampPos == std::string::npos) ampPos = queryString.length() - 1;
+        size_t ampPos = queryString.find_first_of('&', i);
 
+        if (ampPos == std::string_view::npos) ampPos = queryString.length();
 
         size_t eql = queryString.find_first_of('=', i);
+        if (eql > ampPos) eql = ampPos;
 
-        key = queryString.substr(i, eql - i); 
-        value = queryString.substr(eql+1, ampPos - eql - 1);
+        std::string_view key = queryString.substr(i, eql - i); 
+        std::string_view value = eql < ampPos ? queryString.substr(eql + 1, ampPos - eql - 1) : std::string_view();
 
-        req.data.queryParams[key] = value;
-
-        // std::cout << key << ":" << value << "\n";
+        req.data.queryParams.insert_or_assign(std::pmr::string(key, req.data.queryParams.get_allocator()), value);
 
         i = ampPos + 1; 
     }
 
-
-    
+    // update the path without the query param, the views above are done with it
+    req.data.path.resize(qm);
     next();
 }
 
@@ -81,13 +90,21 @@ void parseJson(Request &req, Response &res, Next next){
 
     // only parse if the body is json 
     // std::cout << req.data.body << "\n";
-    if (req.data.headers["Content-Type"] != "application/json") 
+    std::string_view contentType = req.zeroCopy ? req.view.header("Content-Type") : std::string_view(req.data.headers["Content-Type"]);
+    std::string_view body = req.zeroCopy ? req.view.body : std::string_view(req.data.body);
+    if (contentType != "application/json") 
     {
         next();
         return;
     }
 
-    req.data.bodyJson = json::parse(req.data.body);
+    // a malformed body is the client's fault, don't let it take the loop down
+    try {
+        req.data.bodyJson = json::parse(body.begin(), body.end());
+    } catch (const json::exception &) {
+        res.sendHTML("", 400);
+        return;
+    }
     next();
 }
 
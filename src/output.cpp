@@ -0,0 +1,163 @@
+#include "output.hpp"
+#include <unistd.h>
+
+OutputQueue::~OutputQueue()
+{
+    clear();
+}
+
+static const size_t SPARE_CAPACITY = 16384; // larger buffers are freed, not kept per connection
+static const size_t COPY_THRESHOLD = 1024;  // smaller bodies are copied behind their headers
+
+std::string &OutputQueue::tail()
+{
+    // consecutive writes share one chunk, so headers and small bodies go out in one iovec
+    OutputChunk *back = chunks.empty() ? nullptr : &chunks.back();
+    if (!back || back->isFile() || back->shared || back->sealed)
+    {
+        chunks.emplace_back();
+        chunks.back().data = std::move(spare);
+        spare.clear();
+    }
+    return chunks.back().data;
+}
+
+void OutputQueue::append(const char *data, size_t size)
+{
+    tail().append(data, size);
+}
+
+void OutputQueue::appendOwned(std::string &&data)
+{
+    if (data.size() < COPY_THRESHOLD)
+    {
+        append(data.data(), data.size());
+        return;
+    }
+
+    OutputChunk chunk;
+    chunk.data = std::move(data);
+    chunk.sealed = true;
+    chunks.push_back(std::move(chunk));
+}
+
+void OutputQueue::appendShared(const char *data, size_t size)
+{
+    if (size == 0)
+        return;
+
+    OutputChunk chunk;
+    chunk.shared = data;
+    chunk.sharedLength = size;
+    chunks.push_back(std::move(chunk));
+}
+
+void OutputQueue::appendFile(int fd, off_t offset, size_t length)
+{
+    if (length == 0)
+    {
+        close(fd);
+        return;
+    }
+
+    OutputChunk chunk;
+    chunk.fileFd = fd;
+    chunk.fileOffset = offset;
+    chunk.fileRemaining = length;
+    chunks.push_back(std::move(chunk));
+}
+
+void OutputQueue::splice(OutputQueue &other)
+{
+    // moved as they are, owned file descriptors travel with their chunks
+    for (OutputChunk &chunk : other.chunks)
+    {
+        chunks.push_back(std::move(chunk));
+    }
+    other.chunks.clear();
+    other.frontOffset = 0;
+}
+
+OutputQueue::Mark OutputQueue::mark() const
+{
+    Mark mark;
+    mark.chunks = chunks.size();
+    if (!chunks.empty())
+        mark.backSize = chunks.back().isFile() ? chunks.back().fileRemaining : chunks.back().size();
+    return mark;
+}
+
+size_t OutputQueue::bytesSince(const Mark &mark) const
+{
+    size_t bytes = 0;
+    for (size_t i = mark.chunks ? mark.chunks - 1 : 0; i < chunks.size(); i++)
+    {
+        const OutputChunk &chunk = chunks[i];
+        bytes += chunk.isFile() ? chunk.fileRemaining : chunk.size();
+    }
+    // the back chunk at the mark may have grown, only its growth is new
+    return mark.chunks ? bytes - mark.backSize : bytes;
+}
+
+size_t OutputQueue::pending() const
+{
+    size_t bytes = 0;
+    for (const OutputChunk &chunk : chunks)
+    {
+        bytes += chunk.isFile() ? chunk.fileRemaining : chunk.size();
+    }
+    return bytes - frontOffset;
+}
+
+int OutputQueue::gather(iovec *iov, int max) const
+{
+    int count = 0;
+    for (const OutputChunk &chunk : chunks)
+    {
+        if (count == max || chunk.isFile())
+            break;
+        size_t skip = count == 0 ? frontOffset : 0;
+        iov[count].iov_base = (void *)(chunk.bytes() + skip);
+        iov[count].iov_len = chunk.size() - skip;
+        count++;
+    }
+    return count;
+}
+
+void OutputQueue::consume(size_t bytes)
+{
+    while (bytes > 0 && !chunks.empty() && !chunks.front().isFile())
+    {
+        size_t left = chunks.front().size() - frontOffset;
+        if (bytes < left)
+        {
+            frontOffset += bytes;
+            return;
+        }
+        bytes -= left;
+        popFront();
+    }
+}
+
+void OutputQueue::popFront()
+{
+    OutputChunk &front = chunks.front();
+    if (front.isFile())
+        close(front.fileFd);
+    else if (!front.shared && !front.sealed && front.data.capacity() > spare.capacity() &&
+             front.data.capacity() <= SPARE_CAPACITY)
+    {
+        front.data.clear();
+        spare = std::move(front.data);
+    }
+    chunks.pop_front();
+    frontOffset = 0;
+}
+
+void OutputQueue::clear()
+{
+    while (!chunks.empty())
+    {
+        popFront();
+    }
+}
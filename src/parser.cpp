@@ -0,0 +1,316 @@
+#include "parser.hpp"
+#include "simd.hpp"
+#include <strings.h>
+
+// RFC 9110 tchar, the characters allowed in methods and header names
+static bool isToken(unsigned char c)
+{
+    static const bool table[256] = {
+        // 0x00 - 0x1f: control characters
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        //  !  "  #  $  %  &  '  (  )  *  +  ,  -  .  /
+        0, 1, 0, 1, 1, 1, 1, 1, 0, 0, 1, 1, 0, 1, 1, 0,
+        // 0-9 : ; < = > ?
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0,
+        // @ A-O
+        0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        // P-Z [ \ ] ^ _
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 1, 1,
+        // ` a-o
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        // p-z { | } ~ DEL
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, 0, 1, 0,
+        // 0x80 - 0xff: not allowed
+    };
+    return table[c];
+}
+
+static bool equalsIgnoreCase(const char *data, const Span &span, const char *literal, size_t length)
+{
+    return span.length == length && strncasecmp(data + span.offset, literal, length) == 0;
+}
+
+// true when the comma separated header value lists the token (case-insensitive)
+static bool hasToken(const char *data, const Span &value, const char *token, size_t length)
+{
+    size_t i = value.offset;
+    size_t end = value.offset + value.length;
+
+    while (i < end)
+    {
+        while (i < end && (data[i] == ' ' || data[i] == '\t' || data[i] == ','))
+            i++;
+        size_t start = i;
+        while (i < end && data[i] != ',')
+            i++;
+        size_t stop = i;
+        while (stop > start && (data[stop - 1] == ' ' || data[stop - 1] == '\t'))
+            stop--;
+
+        if (stop - start == length && strncasecmp(data + start, token, length) == 0)
+            return true;
+    }
+    return false;
+}
+
+void RequestParser::reset()
+{
+    method = target = version = body = Span{};
+    headerCount = 0;
+    contentLength = 0;
+    http10 = false;
+    connectionClose = false;
+    connectionKeepAlive = false;
+    errorStatus = 0;
+
+    state = State::METHOD;
+    position = 0;
+    tokenStart = 0;
+    valueEnd = 0;
+    bodyStart = 0;
+    seenContentLength = false;
+}
+
+ParseResult RequestParser::fail(int status)
+{
+    errorStatus = status;
+    state = State::DONE;
+    return ParseResult::ERROR;
+}
+
+// Picks up the headers that decide how the message is framed. Returns false
+// when the request has to be rejected, errorStatus is set by then.
+bool RequestParser::onHeader(const char *data, const HeaderSpan &header)
+{
+    if (equalsIgnoreCase(data, header.name, "content-length", 14))
+    {
+        if (header.value.length == 0 || header.value.length > 15)
+        {
+            errorStatus = header.value.length > 15 ? 413 : 400;
+            return false;
+        }
+
+        size_t length = 0;
+        for (uint32_t i = 0; i < header.value.length; i++)
+        {
+            char c = data[header.value.offset + i];
+            if (c < '0' || c > '9')
+            {
+                errorStatus = 400;
+                return false;
+            }
+            length = length * 10 + (c - '0');
+        }
+
+        // two different lengths is a request smuggling attempt
+        if (seenContentLength && length != contentLength)
+        {
+            errorStatus = 400;
+            return false;
+        }
+        seenContentLength = true;
+        contentLength = length;
+    }
+    else if (equalsIgnoreCase(data, header.name, "transfer-encoding", 17))
+    {
+        // chunked request bodies are not supported
+        errorStatus = 501;
+        return false;
+    }
+    else if (equalsIgnoreCase(data, header.name, "connection", 10))
+    {
+        if (hasToken(data, header.value, "close", 5))
+            connectionClose = true;
+        if (hasToken(data, header.value, "keep-alive", 10))
+            connectionKeepAlive = true;
+    }
+    return true;
+}
+
+ParseResult RequestParser::endHeaders(size_t size)
+{
+    bodyStart = position + 1;
+
+    if (contentLength > maxBodyBytes)
+        return fail(413);
+
+    state = State::BODY;
+    position = bodyStart;
+
+    if (size < bodyStart + contentLength)
+        return ParseResult::INCOMPLETE;
+
+    body = {(uint32_t)bodyStart, (uint32_t)contentLength};
+    state = State::DONE;
+    return ParseResult::COMPLETE;
+}
+
+ParseResult RequestParser::parse(const char *data, size_t size)
+{
+    if (state == State::DONE)
+        return errorStatus ? ParseResult::ERROR : ParseResult::COMPLETE;
+
+    while (position < size && state != State::BODY)
+    {
+        // skip the bytes that only extend the current target, name or value
+        // in bulk, the switch below then sees the byte that ends it
+        size_t run = 0;
+        if (state == State::TARGET)
+            run = simd::scanTarget(data + position, size - position);
+        else if (state == State::HEADER_NAME)
+            run = simd::scanToken(data + position, size - position);
+        else if (state == State::HEADER_VALUE)
+        {
+            run = simd::scanValue(data + position, size - position);
+            for (size_t i = position + run; i > position; i--)
+            {
+                if (data[i - 1] != ' ' && data[i - 1] != '\t')
+                {
+                    valueEnd = i;
+                    break;
+                }
+            }
+        }
+        if (run)
+        {
+            position += run;
+            if (position > maxHeaderBytes)
+                return fail(state == State::TARGET ? 414 : 431); // still in the request-target: the URI is what's too long
+            if (position == size)
+                break;
+        }
+
+        unsigned char c = data[position];
+
+        switch (state)
+        {
+        case State::METHOD:
+            if (c == ' ')
+            {
+                if (position == tokenStart)
+                    return fail(400);
+                method = {(uint32_t)tokenStart, (uint32_t)(position - tokenStart)};
+                tokenStart = position + 1;
+                state = State::TARGET;
+            }
+            else if ((c == '\r' || c == '\n') && position == tokenStart)
+            {
+                // stray CRLF between pipelined requests
+                tokenStart = position + 1;
+            }
+            else if (!isToken(c))
+                return fail(400);
+            break;
+
+        case State::TARGET:
+            if (c == ' ')
+            {
+                if (position == tokenStart)
+                    return fail(400);
+                target = {(uint32_t)tokenStart, (uint32_t)(position - tokenStart)};
+                tokenStart = position + 1;
+                state = State::VERSION;
+            }
+            else if (c <= 0x20 || c == 0x7f)
+                return fail(400);
+            break;
+
+        case State::VERSION:
+            if (c == '\r' || c == '\n')
+            {
+                version = {(uint32_t)tokenStart, (uint32_t)(position - tokenStart)};
+                if (version.length != 8 || !equalsIgnoreCase(data, {version.offset, 7}, "HTTP/1.", 7) ||
+                    (data[tokenStart + 7] != '0' && data[tokenStart + 7] != '1'))
+                    return fail(400);
+                http10 = data[tokenStart + 7] == '0';
+                state = c == '\r' ? State::REQUEST_LINE_LF : State::HEADER_START;
+            }
+            else if (position - tokenStart >= 8)
+                return fail(400);
+            break;
+
+        case State::REQUEST_LINE_LF:
+            if (c != '\n')
+                return fail(400);
+            state = State::HEADER_START;
+            break;
+
+        case State::HEADER_START:
+            if (c == '\r')
+                state = State::HEADERS_END_LF;
+            else if (c == '\n')
+                return endHeaders(size);
+            else if (isToken(c))
+            {
+                if (headerCount == MAX_HEADERS)
+                    return fail(431);
+                tokenStart = position;
+                state = State::HEADER_NAME;
+            }
+            else
+                return fail(400); // includes obsolete line folding
+            break;
+
+        case State::HEADER_NAME:
+            if (c == ':')
+            {
+                headers[headerCount].name = {(uint32_t)tokenStart, (uint32_t)(position - tokenStart)};
+                state = State::HEADER_VALUE_START;
+            }
+            else if (!isToken(c))
+                return fail(400);
+            break;
+
+        case State::HEADER_VALUE_START:
+            if (c == ' ' || c == '\t')
+                break;
+            tokenStart = position;
+            valueEnd = position;
+            state = State::HEADER_VALUE;
+            continue; // look at this byte again as part of the value
+
+        case State::HEADER_VALUE:
+            if (c == '\r' || c == '\n')
+            {
+                HeaderSpan &header = headers[headerCount];
+                header.value = {(uint32_t)tokenStart, (uint32_t)(valueEnd - tokenStart)};
+                headerCount++;
+                if (!onHeader(data, header))
+                    return fail(errorStatus);
+                state = c == '\r' ? State::HEADER_LF : State::HEADER_START;
+            }
+            else if ((c < 0x20 && c != '\t') || c == 0x7f)
+                return fail(400);
+            else if (c != ' ' && c != '\t')
+                valueEnd = position + 1;
+            break;
+
+        case State::HEADER_LF:
+            if (c != '\n')
+                return fail(400);
+            state = State::HEADER_START;
+            break;
+
+        case State::HEADERS_END_LF:
+            if (c != '\n')
+                return fail(400);
+            return endHeaders(size);
+
+        default:
+            break;
+        }
+
+        position++;
+        if (position > maxHeaderBytes)
+            return fail(state == State::TARGET ? 414 : 431);
+    }
+
+    if (state == State::BODY && size >= bodyStart + contentLength)
+    {
+        body = {(uint32_t)bodyStart, (uint32_t)contentLength};
+        state = State::DONE;
+        return ParseResult::COMPLETE;
+    }
+    return ParseResult::INCOMPLETE;
+}
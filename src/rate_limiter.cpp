@@ -0,0 +1,78 @@
+#include "rate_limiter.hpp"
+#include <chrono>
+#include <algorithm>
+
+static int64_t monotonicNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void RateLimiter::configure(int limit, int windowSeconds, size_t maxEntries)
+{
+    int64_t window = (int64_t)windowSeconds * 1000000000LL;
+    interval = limit > 0 ? std::max<int64_t>(1, window / limit) : window;
+    burst = window - interval;
+    maxPerShard = std::max<size_t>(1, maxEntries / SHARDS);
+}
+
+// Drops every peer whose bucket has refilled completely. Under an address spray
+// that leaves too little, the table is capped by evicting an arbitrary peer,
+// which at worst hands that peer a fresh burst.
+void RateLimiter::evict(Shard &shard, int64_t now)
+{
+    if (now >= shard.nextSweep)
+    {
+        for (auto it = shard.arrivals.begin(); it != shard.arrivals.end();)
+        {
+            if (it->second <= now)
+                it = shard.arrivals.erase(it);
+            else
+                ++it;
+        }
+        // full scans are rate limited themselves, so a table of live peers can't make every insert O(n)
+        shard.nextSweep = now + interval + burst;
+    }
+
+    while (shard.arrivals.size() >= maxPerShard)
+        shard.arrivals.erase(shard.arrivals.begin());
+}
+
+bool RateLimiter::allow(const PeerKey &peer, int &retryAfter)
+{
+    size_t hash = PeerKeyHash{}(peer);
+    Shard &shard = shards[hash % SHARDS];
+    int64_t now = monotonicNow();
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.arrivals.find(peer);
+    if (it == shard.arrivals.end())
+    {
+        if (shard.arrivals.size() >= maxPerShard)
+            evict(shard, now);
+        shard.arrivals.emplace(peer, now + interval);
+        return true;
+    }
+
+    int64_t arrival = std::max(it->second, now);
+    if (arrival - now > burst)
+    {
+        int64_t wait = arrival - burst - now;
+        retryAfter = (int)((wait + 999999999LL) / 1000000000LL);
+        return false;
+    }
+
+    it->second = arrival + interval;
+    return true;
+}
+
+size_t RateLimiter::size()
+{
+    size_t total = 0;
+    for (Shard &shard : shards)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        total += shard.arrivals.size();
+    }
+    return total;
+}
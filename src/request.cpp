@@ -1,91 +1,209 @@
 #include "request.hpp"
-#include <sstream>
+#include <strings.h>
 
-Request::Request(int connfd):connfd(connfd){
-    // on receiving the data we will parse it and store in the 
+Request::Request(int connfd, const RequestParser &parser, const char *raw, std::pmr::memory_resource *arena, bool zeroCopy)
+    : data(arena), view(arena), zeroCopy(zeroCopy), connfd(connfd){
+    // the event loop only hands us a request once the parser has seen all of its bytes
     data.bodyJson = {};
-    parseRequest();
+    if (zeroCopy)
+        parseView(parser, raw, arena);
+    else
+        parseRequest(parser, raw);
 };
 
-void Request::parseCookies(std::string cookieStr){
-    size_t colon = cookieStr.find_first_of(':'); 
-    cookieStr = cookieStr.substr(colon + 1, cookieStr.length() - colon - 1); 
+static int hexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
 
-    uint i = 0; 
-    while (i < cookieStr.length()){
-        size_t semicol = cookieStr.find_first_of(';', i); 
+// Percent-decodes raw ('+' as space too when plusIsSpace). Returns raw itself
+// unless that changes a byte, the decoded copy goes into the arena.
+static std::string_view decode(std::string_view raw, bool plusIsSpace, std::pmr::memory_resource *arena)
+{
+    size_t first = raw.find_first_of(plusIsSpace ? "%+" : "%");
+    if (first == std::string_view::npos)
+        return raw;
 
-        if (semicol == std::string::npos){
-            semicol = cookieStr.length();
-        }
+    char *out = (char *)arena->allocate(raw.size(), 1);
+    memcpy(out, raw.data(), first);
+    size_t length = first;
 
-        size_t eqls = cookieStr.find_first_of('=', i);
+    for (size_t i = first; i < raw.size(); i++)
+    {
+        char x = raw[i];
+        if (x == '+' && plusIsSpace)
+            out[length++] = ' ';
+        else if (x == '%' && i + 2 < raw.size() && hexValue(raw[i + 1]) >= 0 && hexValue(raw[i + 2]) >= 0)
+        {
+            out[length++] = (char)(hexValue(raw[i + 1]) * 16 + hexValue(raw[i + 2]));
+            i += 2;
+        }
+        else
+            out[length++] = x;
+    }
+    return std::string_view(out, length);
+}
 
-        std::string key = cookieStr.substr(i, eqls - i); 
-        std::string value = cookieStr.substr(eqls+1, semicol - eqls - 1); 
+std::string_view Request::routePath() const
+{
+    if (zeroCopy)
+        return view.path;
 
-        data.cookies[key] = value; 
+    // data.path is still the target as sent until urlDecode and paramExtractor run
+    std::string_view target = data.path;
+    return decode(target.substr(0, target.find('?')), false, data.path.get_allocator().resource());
+}
 
-        i = semicol + 1; 
-    };
+static std::string_view find(const std::pmr::vector<ViewPair> &pairs, std::string_view name)
+{
+    for (const ViewPair &pair : pairs)
+    {
+        if (pair.name == name)
+            return pair.value;
+    }
+    return {};
 }
 
-void Request::parseRequest()
+std::string_view RequestView::header(std::string_view name) const
 {
-    // this function is responsible to parse the request we get from the client, so that from then we can support sending files based on the URL that the client gives.
-    char buffer[1024];
-    ssize_t bytes = recv(connfd, buffer, sizeof(buffer), 0);
-
-    if (bytes <= 0){
-        // just check if we have no bytes, the connection is probably closed.
-        data.method = ""; 
-        return;
+    for (const ViewPair &pair : headers)
+    {
+        if (pair.name.size() == name.size() && strncasecmp(pair.name.data(), name.data(), name.size()) == 0)
+            return pair.value;
     }
+    return {};
+}
 
-    if (bytes > 0)
+std::string_view Request::header(std::string_view name) const
+{
+    if (zeroCopy)
+        return view.header(name);
+
+    auto exact = data.headers.find(std::pmr::string(name, data.headers.get_allocator()));
+    if (exact != data.headers.end())
+        return exact->second;
+    for (const auto &it : data.headers)
     {
+        if (it.first.size() == name.size() && strncasecmp(it.first.data(), name.data(), name.size()) == 0)
+            return it.second;
+    }
+    return {};
+}
 
+std::string_view RequestView::queryParam(std::string_view name) const
+{
+    return find(queryParams, name);
+}
 
-        std::string request(buffer, bytes);
-        std::istringstream stream(request);
-        std::string line;
+std::string_view RequestView::cookie(std::string_view name) const
+{
+    return find(cookies, name);
+}
 
-        // read first line
-        if (std::getline(stream, line))
-        {
-            if (!line.empty() && line.back() == '\r')
-            {
-                line.pop_back();
-            }
+std::string_view RequestView::param(std::string_view name) const
+{
+    return find(params, name);
+}
 
-            std::istringstream lineStream(line);
-            lineStream >> data.method >> data.path >> data.version;
-        }
+void Request::parseView(const RequestParser &parser, const char *raw, std::pmr::memory_resource *arena)
+{
+    // the parser already found every token, these only point at them
+    view.method = std::string_view(raw + parser.method.offset, parser.method.length);
+    view.target = std::string_view(raw + parser.target.offset, parser.target.length);
+    view.version = std::string_view(raw + parser.version.offset, parser.version.length);
+    view.body = std::string_view(raw + parser.body.offset, parser.body.length);
+
+    view.headers.reserve(parser.headerCount);
+    for (int i = 0; i < parser.headerCount; i++)
+    {
+        const HeaderSpan &header = parser.headers[i];
+        view.headers.push_back({std::string_view(raw + header.name.offset, header.name.length),
+                                std::string_view(raw + header.value.offset, header.value.length)});
+    }
+
+    // split before decoding, so an encoded '?' or '&' stays data
+    size_t qm = view.target.find('?');
+    view.path = decode(view.target.substr(0, qm), false, arena);
 
-        // now read other header lines
-        while (std::getline(stream, line))
+    if (qm != std::string_view::npos)
+    {
+        std::string_view query = view.target.substr(qm + 1);
+        while (!query.empty())
         {
+            size_t amp = query.find('&');
+            std::string_view pair = query.substr(0, amp);
+            size_t eql = pair.find('=');
+
+            if (!pair.empty())
+                view.queryParams.push_back({decode(pair.substr(0, eql), true, arena),
+                                            eql == std::string_view::npos ? std::string_view() : decode(pair.substr(eql + 1), true, arena)});
+            query = amp == std::string_view::npos ? std::string_view() : query.substr(amp + 1);
+        }
+    }
+
+    // Cookie: a=1; b=2
+    std::string_view cookies = view.header("Cookie");
+    while (!cookies.empty())
+    {
+        size_t semicol = cookies.find(';');
+        std::string_view pair = cookies.substr(0, semicol);
+        while (!pair.empty() && pair.front() == ' ')
+            pair.remove_prefix(1);
+        size_t eql = pair.find('=');
+
+        if (!pair.empty())
+            view.cookies.push_back({pair.substr(0, eql), eql == std::string_view::npos ? std::string_view() : pair.substr(eql + 1)});
+        cookies = semicol == std::string_view::npos ? std::string_view() : cookies.substr(semicol + 1);
+    }
+}
 
-            if (!line.empty() && line.back() == '\r')
-            {
-                line.pop_back();
-            }
+void Request::parseCookies(std::string_view cookieStr){
+    size_t colon = cookieStr.find_first_of(':'); 
+    if (colon != std::string_view::npos) cookieStr = cookieStr.substr(colon + 1); 
 
-            if (line.empty())
-                break;
+    uint i = 0; 
+    while (i < cookieStr.length()){
+        size_t semicol = cookieStr.find_first_of(';', i); 
 
-            size_t colon = line.find(":");
-            std::string key = line.substr(0, colon);
-            std::string value = line.substr(colon + 1, line.size() - colon - 1);
-            data.headers[key] = value;
+        if (semicol == std::string::npos){
+            semicol = cookieStr.length();
         }
 
-        // parse the cookies here 
-        if (!data.headers["Cookie"].empty()) parseCookies(data.headers["Cookie"]);
-        
-        // now the next all bytes are just body
-        std::string body;
-        std::getline(stream, body, '\0');
-        data.body = body;
+        size_t eqls = cookieStr.find_first_of('=', i);
+
+        std::string_view key = cookieStr.substr(i, eqls - i); 
+        std::string_view value = cookieStr.substr(eqls+1, semicol - eqls - 1); 
+
+        data.cookies.insert_or_assign(std::pmr::string(key, data.cookies.get_allocator()), value); 
+
+        i = semicol + 1; 
+    };
+}
+
+void Request::parseRequest(const RequestParser &parser, const char *raw)
+{
+    // the parser already found every token, this only copies them out of the connection buffer
+    data.method.assign(raw + parser.method.offset, parser.method.length);
+    data.path.assign(raw + parser.target.offset, parser.target.length);
+    data.version.assign(raw + parser.version.offset, parser.version.length);
+
+    for (int i = 0; i < parser.headerCount; i++)
+    {
+        const HeaderSpan &header = parser.headers[i];
+        data.headers.insert_or_assign(std::pmr::string(raw + header.name.offset, header.name.length, data.headers.get_allocator()),
+                                      std::string_view(raw + header.value.offset, header.value.length));
     }
-}
\ No newline at end of file
+
+    // parse the cookies here 
+    auto cookie = data.headers.find("Cookie");
+    if (cookie != data.headers.end() && !cookie->second.empty()) parseCookies(cookie->second);
+
+    // now the next all bytes are just body
+    data.body.assign(raw + parser.body.offset, parser.body.length);
+}
@@ -1,48 +1,67 @@
 #include "response.hpp"
 #include "logger.hpp"
 #include <map>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <random>
 
-Response::Response(int connfd)
+Response::Response(int connfd, OutputQueue &out, std::pmr::memory_resource *arena) : headers(arena), out(&out)
 {
     this->connfd = connfd;
-    // 2xx Success
-    STATUSES[200] = "200 OK";
-    STATUSES[201] = "201 Created";
-    STATUSES[202] = "202 Accepted";
-    STATUSES[204] = "204 No Content";
-
-    // 3xx Redirection
-    STATUSES[301] = "301 Moved Permanently";
-    STATUSES[302] = "302 Found";
-    STATUSES[304] = "304 Not Modified";
-    STATUSES[307] = "307 Temporary Redirect";
-    STATUSES[308] = "308 Permanent Redirect";
-
-    // 4xx Client Errors
-    STATUSES[400] = "400 Bad Request";
-    STATUSES[401] = "401 Unauthorized";
-    STATUSES[403] = "403 Forbidden";
-    STATUSES[404] = "404 Not Found";
-    STATUSES[405] = "405 Method Not Allowed";
-    STATUSES[408] = "408 Request Timeout";
-    STATUSES[409] = "409 Conflict";
-    STATUSES[410] = "410 Gone";
-    STATUSES[413] = "413 Payload Too Large";
-    STATUSES[415] = "415 Unsupported Media Type";
-    STATUSES[429] = "429 Too Many Requests";
-
-    // 5xx Server Errors
-    STATUSES[500] = "500 Internal Server Error";
-    STATUSES[501] = "501 Not Implemented";
-    STATUSES[502] = "502 Bad Gateway";
-    STATUSES[503] = "503 Service Unavailable";
-    STATUSES[504] = "504 Gateway Timeout";
+}
+
+const std::string &Response::statusLine(int statusCode)
+{
+    // built once for the whole process, not per response
+    static const std::unordered_map<int, std::string> STATUSES = {
+        // 2xx Success
+        {200, "200 OK"},
+        {201, "201 Created"},
+        {202, "202 Accepted"},
+        {204, "204 No Content"},
+        {206, "206 Partial Content"},
+
+        // 3xx Redirection
+        {301, "301 Moved Permanently"},
+        {302, "302 Found"},
+        {304, "304 Not Modified"},
+        {307, "307 Temporary Redirect"},
+        {308, "308 Permanent Redirect"},
+
+        // 4xx Client Errors
+        {400, "400 Bad Request"},
+        {401, "401 Unauthorized"},
+        {403, "403 Forbidden"},
+        {404, "404 Not Found"},
+        {405, "405 Method Not Allowed"},
+        {408, "408 Request Timeout"},
+        {409, "409 Conflict"},
+        {410, "410 Gone"},
+        {413, "413 Payload Too Large"},
+        {414, "414 URI Too Long"},
+        {415, "415 Unsupported Media Type"},
+        {416, "416 Range Not Satisfiable"},
+        {429, "429 Too Many Requests"},
+        {431, "431 Request Header Fields Too Large"},
+
+        // 5xx Server Errors
+        {500, "500 Internal Server Error"},
+        {501, "501 Not Implemented"},
+        {502, "502 Bad Gateway"},
+        {503, "503 Service Unavailable"},
+        {504, "504 Gateway Timeout"}};
+    static const std::string unknown;
+
+    auto it = STATUSES.find(statusCode);
+    return it == STATUSES.end() ? unknown : it->second;
 }
 
 Response::~Response() {};
 
-void Response::setHTTPHeader(std::string key, std::string value){
-    headers[key] = value;
+void Response::setHTTPHeader(std::string_view key, std::string_view value){
+    headers.insert_or_assign(std::pmr::string(key, headers.get_allocator()), value);
 }
 
 void Response::setCookie(std::string key, std::string value, cookieOptions options){
@@ -67,6 +86,139 @@ void Response::setCookie(std::string key, std::string value, cookieOptions optio
     setHTTPHeader("Set-Cookie", key + "=" + value);
 }
 
+void Response::writeOut(const char *data, size_t size){
+    // responses are queued on the connection, the event loop owns the actual socket writes
+    out->append(data, size);
+}
+
+// Status line and headers appended straight into buffer, which is normally the
+// connection's reusable output chunk. A cached head already carries the status
+// line and content headers.
+void Response::serializeHead(std::string &buffer, bool cached)
+{
+    if (!cached)
+    {
+        buffer += "HTTP/1.1 ";
+        buffer += status;
+        buffer += "\r\n";
+    }
+    for (auto &it : headers)
+    {
+        if (cached && (it.first == "Content-Type" || it.first == "Content-Length"))
+            continue;
+        buffer += it.first;
+        buffer += ": ";
+        buffer += it.second;
+        buffer += "\r\n";
+    }
+    // --- Empty line for headers ending
+    buffer += "\r\n";
+}
+
+// one per worker thread, its zlib streams are reused by every response the thread writes
+static thread_local Compressor compressor;
+
+// Compresses a dynamic body in place when it is large enough, of a type that
+// isn't already compressed, and the client takes gzip or deflate.
+void Response::compressBody(std::string &body)
+{
+    if (compressMinSize == 0 || body.size() < compressMinSize)
+        return;
+    auto type = headers.find(std::pmr::string("Content-Type", headers.get_allocator()));
+    if (type == headers.end() || !compression::compressible(type->second) ||
+        headers.count(std::pmr::string("Content-Encoding", headers.get_allocator())))
+        return;
+
+    // the representation depends on the header from here on, even when we send identity
+    setHTTPHeader("Vary", "Accept-Encoding");
+    unsigned offered = 0;
+    for (Encoding encoding : {Encoding::DEFLATE, Encoding::GZIP})
+    {
+        if (compression::available(encoding))
+            offered |= 1u << (int)encoding;
+    }
+    Encoding encoding = compression::negotiate(acceptEncoding, offered);
+    if (encoding == Encoding::IDENTITY)
+        return;
+
+    compressor.maxLevel = compressLevel;
+    std::string compressed;
+    if (!compressor.begin(encoding) || !compressor.compress(body, compressed) ||
+        compressed.size() >= body.size())
+        return;
+
+    body = std::move(compressed);
+    setHTTPHeader("Content-Encoding", compression::token(encoding));
+    setHTTPHeader("Content-Length", std::to_string(body.size()));
+}
+
+// Headers go into the connection buffer, the body is handed over as its own
+// iovec, it is never concatenated with the headers.
+void Response::writeResponse(std::string &&body)
+{
+    compressBody(body);
+    if (headOnly)
+        body.clear(); // Content-Length already describes the GET body
+
+    serializeHead(out->tail());
+    out->appendOwned(std::move(body));
+}
+
+// Sends the head of a streamed response once, the body length isn't known up front
+void Response::beginStream()
+{
+    if (streaming)
+        return;
+
+    headers.erase(std::pmr::string("Content-Length", headers.get_allocator()));
+    if (http10)
+        setHTTPHeader("Connection", "close");
+    else
+        setHTTPHeader("Transfer-Encoding", "chunked");
+
+    serializeHead(out->tail());
+    streaming = std::make_unique<ResponseStream>(out, !http10, headOnly);
+}
+
+void Response::write(std::string_view chunk)
+{
+    beginStream();
+    streaming->write(chunk);
+}
+
+void Response::write(const char *chunk)
+{
+    write(std::string_view(chunk));
+}
+
+void Response::write(std::string &&chunk)
+{
+    beginStream();
+    streaming->write(std::move(chunk));
+}
+
+void Response::trailer(std::string_view name, std::string_view value)
+{
+    beginStream();
+    streaming->trailer(name, value);
+}
+
+void Response::end()
+{
+    beginStream();
+    streaming->end();
+}
+
+void Response::stream(ResponseStream::Producer producer)
+{
+    beginStream();
+    // a HEAD response has no body to produce
+    if (headOnly)
+        streaming->end();
+    else
+        streaming->producer = std::move(producer);
+}
+
 std::string Response::prepareRequest(){
     std::string request = "HTTP/1.1 " + status + "\r\n"; 
     for (auto &it: headers){
@@ -79,40 +231,389 @@ std::string Response::prepareRequest(){
     return request;
 }
 
+// true when the If-None-Match list holds etag, weak comparison as RFC 9110 asks for GET
+static bool matchesEntityTag(std::string_view list, std::string_view etag)
+{
+    while (!list.empty())
+    {
+        size_t comma = list.find(',');
+        std::string_view tag = list.substr(0, comma);
+        list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+
+        while (!tag.empty() && (tag.front() == ' ' || tag.front() == '\t'))
+            tag.remove_prefix(1);
+        while (!tag.empty() && (tag.back() == ' ' || tag.back() == '\t'))
+            tag.remove_suffix(1);
+        if (tag == "*")
+            return true;
+        if (tag.substr(0, 2) == "W/")
+            tag.remove_prefix(2);
+        if (tag == etag)
+            return true;
+    }
+    return false;
+}
+
+bool Response::notModified(std::string_view etag, std::string_view lastModified, time_t modified) const
+{
+    // If-Modified-Since only counts when there is no If-None-Match
+    if (!ifNoneMatch.empty())
+        return matchesEntityTag(ifNoneMatch, etag);
+    if (ifModifiedSince.empty())
+        return false;
+
+    // clients normally echo our Last-Modified back byte for byte
+    if (ifModifiedSince == lastModified)
+        return true;
+    tm parts{};
+    std::string since(ifModifiedSince);
+    if (!strptime(since.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &parts))
+        return false;
+    return modified <= timegm(&parts);
+}
+
+// 304 with the validators, no body and no Content-Length
+void Response::sendNotModified(std::string_view etag, std::string_view lastModified)
+{
+    status = statusLine(304);
+    headers.erase(std::pmr::string("Content-Length", headers.get_allocator()));
+    setHTTPHeader("ETag", etag);
+    setHTTPHeader("Last-Modified", lastModified);
+    serializeHead(out->tail());
+}
+
+// ---- Range requests
+
+struct ByteRange
+{
+    uint64_t first;
+    uint64_t last; // inclusive
+};
+
+static const int MAX_RANGES = 16; // more parts than this gets the whole file instead
+
+static bool parseOffset(std::string_view text, uint64_t &value)
+{
+    if (text.empty() || text.size() > 19)
+        return false;
+    value = 0;
+    for (char c : text)
+    {
+        if (c < '0' || c > '9')
+            return false;
+        value = value * 10 + (c - '0');
+    }
+    return true;
+}
+
+// Ranges of a "bytes=" value clipped to size. Returns how many are satisfiable,
+// 0 when none is (416), or -1 when the header is to be ignored: another unit,
+// a syntax error, or too many ranges.
+static int parseRanges(std::string_view value, uint64_t size, ByteRange *ranges)
+{
+    if (value.substr(0, 6) != "bytes=")
+        return -1;
+    value.remove_prefix(6);
+
+    int count = 0;
+    int seen = 0;
+    while (!value.empty())
+    {
+        size_t comma = value.find(',');
+        std::string_view spec = value.substr(0, comma);
+        value = comma == std::string_view::npos ? std::string_view() : value.substr(comma + 1);
+
+        while (!spec.empty() && (spec.front() == ' ' || spec.front() == '\t'))
+            spec.remove_prefix(1);
+        while (!spec.empty() && (spec.back() == ' ' || spec.back() == '\t'))
+            spec.remove_suffix(1);
+        if (spec.empty())
+            continue;
+        if (++seen > MAX_RANGES)
+            return -1;
+
+        size_t dash = spec.find('-');
+        if (dash == std::string_view::npos)
+            return -1;
+        std::string_view from = spec.substr(0, dash);
+        std::string_view to = spec.substr(dash + 1);
+
+        uint64_t first, last;
+        if (from.empty())
+        {
+            // suffix range, the last n bytes
+            uint64_t length;
+            if (!parseOffset(to, length))
+                return -1;
+            if (length == 0 || size == 0)
+                continue;
+            first = length >= size ? 0 : size - length;
+            last = size - 1;
+        }
+        else
+        {
+            if (!parseOffset(from, first))
+                return -1;
+            if (to.empty())
+                last = size - 1;
+            else if (!parseOffset(to, last) || last < first)
+                return -1;
+            if (first >= size)
+                continue;
+            if (last >= size)
+                last = size - 1;
+        }
+        ranges[count++] = {first, last};
+    }
+    return seen ? count : -1;
+}
+
+// one range of the source, shared memory or a dup'd file descriptor for the output queue
+void Response::writePart(const RangeSource &source, uint64_t offset, uint64_t length)
+{
+    if (source.memory)
+    {
+        out->appendShared(source.memory + offset, length);
+        return;
+    }
+
+    int fd = fcntl(source.fd, F_DUPFD_CLOEXEC, 0);
+    if (fd >= 0)
+        out->appendFile(fd, offset, length);
+}
+
+// Answers a Range request with 206 (one part, or multipart/byteranges) or 416.
+// Returns false when the full 200 response should go out instead: no Range,
+// a stale If-Range, or a Range value we ignore.
+bool Response::sendRanges(const RangeSource &source)
+{
+    if (range.empty())
+        return false;
+    // If-Range is an entity tag (strong comparison) or the exact Last-Modified date
+    if (!ifRange.empty())
+    {
+        bool current = ifRange.front() == '"' ? !source.etag.empty() && ifRange == source.etag
+                                               : !source.lastModified.empty() && ifRange == source.lastModified;
+        if (!current)
+            return false;
+    }
+
+    ByteRange ranges[MAX_RANGES];
+    int count = parseRanges(range, source.size, ranges);
+    if (count < 0)
+        return false;
+
+    headers.erase(std::pmr::string("Content-Type", headers.get_allocator()));
+    setHTTPHeader("Accept-Ranges", "bytes");
+    if (!source.etag.empty())
+        setHTTPHeader("ETag", source.etag);
+    if (!source.lastModified.empty())
+        setHTTPHeader("Last-Modified", source.lastModified);
+    if (source.encoding != Encoding::IDENTITY)
+        setHTTPHeader("Content-Encoding", compression::token(source.encoding));
+    std::string total = std::to_string(source.size);
+
+    if (count == 0)
+    {
+        status = statusLine(416);
+        setHTTPHeader("Content-Range", "bytes */" + total);
+        setHTTPHeader("Content-Length", "0");
+        writeResponse(std::string());
+        return true;
+    }
+
+    status = statusLine(206);
+    if (count == 1)
+    {
+        uint64_t length = ranges[0].last - ranges[0].first + 1;
+        setHTTPHeader("Content-Type", source.contentType);
+        setHTTPHeader("Content-Range", "bytes " + std::to_string(ranges[0].first) + "-" + std::to_string(ranges[0].last) + "/" + total);
+        setHTTPHeader("Content-Length", std::to_string(length));
+        serializeHead(out->tail());
+        if (!headOnly)
+            writePart(source, ranges[0].first, length);
+        return true;
+    }
+
+    // the boundary only has to be absent from the parts, random per process is enough
+    static const std::string boundary = []
+    {
+        std::string text;
+        std::random_device random;
+        for (int i = 0; i < 4; i++)
+        {
+            char hex[9];
+            snprintf(hex, sizeof(hex), "%08x", random());
+            text += hex;
+        }
+        return text;
+    }();
+
+    std::string partHeads[MAX_RANGES];
+    uint64_t length = 0;
+    for (int i = 0; i < count; i++)
+    {
+        partHeads[i] = "\r\n--" + boundary + "\r\nContent-Type: " + std::string(source.contentType) +
+                       "\r\nContent-Range: bytes " + std::to_string(ranges[i].first) + "-" + std::to_string(ranges[i].last) + "/" + total + "\r\n\r\n";
+        length += partHeads[i].size() + ranges[i].last - ranges[i].first + 1;
+    }
+    std::string closing = "\r\n--" + boundary + "--\r\n";
+    length += closing.size();
+
+    setHTTPHeader("Content-Type", "multipart/byteranges; boundary=" + boundary);
+    setHTTPHeader("Content-Length", std::to_string(length));
+    serializeHead(out->tail());
+    if (headOnly)
+        return true;
+
+    for (int i = 0; i < count; i++)
+    {
+        writeOut(partHeads[i].data(), partHeads[i].size());
+        writePart(source, ranges[i].first, ranges[i].last - ranges[i].first + 1);
+    }
+    writeOut(closing.data(), closing.size());
+    return true;
+}
+
 void Response::sendFile(std::string &filepath, int statusCode)
 {
-    // in this function we will need to store the file contents in the buffer first and then send  them through the socket.
-    // open the file
-    status = STATUSES[statusCode];
-    filepath = filepath;
-    std::ifstream file(filepath, std::ios::binary);
+    if (assets && statusCode == 200)
+    {
+        bool vary = false;
+        const CachedAsset *asset = assets->select(filepath, acceptEncoding, vary);
+        if (asset)
+        {
+            if (vary)
+                setHTTPHeader("Vary", "Accept-Encoding");
+            if (notModified(asset->etag, asset->lastModified, asset->modified))
+            {
+                sendNotModified(asset->etag, asset->lastModified);
+                return;
+            }
 
-    if (!file)
+            RangeSource source;
+            source.memory = asset->fd < 0 ? asset->body.data() : nullptr;
+            source.fd = asset->fd;
+            source.size = asset->size;
+            source.contentType = asset->contentType;
+            source.etag = asset->etag;
+            source.lastModified = asset->lastModified;
+            source.encoding = asset->encoding;
+            if (!sendRanges(source))
+                sendCached(*asset);
+            return;
+        }
+        // only the compressed variants are stored, the identity one still depends on the header
+        if (vary)
+            setHTTPHeader("Vary", "Accept-Encoding");
+    }
+
+    // revalidation is answered from stat(2) alone, the file is only opened to send it
+    struct stat st{};
+    if (statusCode == 200 && (!ifNoneMatch.empty() || !ifModifiedSince.empty()) &&
+        stat(filepath.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+    {
+        std::string etag = AssetCache::entityTag(st, Encoding::IDENTITY);
+        std::string lastModified = AssetCache::httpDate(st.st_mtime);
+        if (notModified(etag, lastModified, st.st_mtime))
+        {
+            sendNotModified(etag, lastModified);
+            return;
+        }
+    }
+
+    // the file itself is never read here, the I/O loop sendfile()s it after the headers
+    status = statusLine(statusCode);
+    int fd = open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+    bool found = fd >= 0;
+
+    if (fd < 0)
     {
         logger.warn("File not found: " + filepath);
-        status = STATUSES[404];
-        file.open(notFoundPath, std::ios::binary);
+        status = statusLine(404);
+        fd = open(notFoundPath.c_str(), O_RDONLY | O_CLOEXEC);
     }
 
     // get the file size first
-    file.seekg(0, std::ios::end);
-    size_t size = file.tellg();
-    file.seekg(0, std::ios::beg);
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        if (fd >= 0)
+            close(fd);
+        sendHTML("<h1>404 Not Found!</h1>", 404);
+        return;
+    }
+    off_t size = st.st_size;
+
+    std::string contentType = getContentType(filepath);
+    if (found && statusCode == 200)
+    {
+        std::string etag = AssetCache::entityTag(st, Encoding::IDENTITY);
+        std::string lastModified = AssetCache::httpDate(st.st_mtime);
+
+        RangeSource source;
+        source.fd = fd;
+        source.size = size;
+        source.contentType = contentType;
+        source.etag = etag;
+        source.lastModified = lastModified;
+        if (sendRanges(source))
+        {
+            close(fd);
+            return;
+        }
+
+        setHTTPHeader("ETag", etag);
+        setHTTPHeader("Last-Modified", lastModified);
+        setHTTPHeader("Accept-Ranges", "bytes");
+    }
 
     // now send the file in the reponse with appropriate file type
-    // std::string headers = getHTTPHeaders(STATUSES[statusCode], getContentType(filepath), std::to_string(size));
-    this->setHTTPHeader("Content-Type", getContentType(filepath)); 
+    this->setHTTPHeader("Content-Type", contentType); 
     this->setHTTPHeader("Content-Length", std::to_string(size)); 
-    std::string preparedRequest = prepareRequest();
 
-    send(connfd, preparedRequest.c_str(), preparedRequest.size(), 0);
+    if (headOnly)
+    {
+        close(fd);
+        fd = -1;
+        size = 0;
+    }
+
+    serializeHead(out->tail());
+    if (fd >= 0)
+        out->appendFile(fd, 0, size);
+}
 
-    // we will chunk the file here as we cannot create those big buffers in memory
-    char buffer[8092];
-    while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0)
+// Cached head and body are referenced, not copied, only the per-response
+// headers (CORS, Connection, cookies) get serialized here.
+void Response::sendCached(const CachedAsset &asset)
+{
+    if (headOnly)
     {
-        send(connfd, buffer, file.gcount(), 0);
+        // same head as GET, Content-Length included, without the bytes
+        out->appendShared(asset.head.data(), asset.head.size());
+        serializeHead(out->tail(), true);
+        return;
     }
+
+    if (asset.fd >= 0)
+    {
+        // memfd variant, the dup is ours to hand to the queue and the file offset is never used
+        int fd = fcntl(asset.fd, F_DUPFD_CLOEXEC, 0);
+        if (fd < 0)
+        {
+            sendHTML("<h1>500 Internal Server Error</h1>", 500);
+            return;
+        }
+
+        out->appendShared(asset.head.data(), asset.head.size());
+        serializeHead(out->tail(), true);
+        out->appendFile(fd, 0, asset.size);
+        return;
+    }
+
+    out->appendShared(asset.head.data(), asset.head.size());
+    serializeHead(out->tail(), true);
+    out->appendShared(asset.body.data(), asset.body.size());
 }
 
 std::string Response::getContentType(const std::string &filepath)
@@ -180,11 +681,32 @@ std::string Response::getContentType(const std::string &filepath)
 void Response::sendHTML(std::string html, int statusCode)
 {
     // prepare the reponse
-    status = STATUSES[statusCode];
+    status = statusLine(statusCode);
     this->setHTTPHeader("Content-Type", "text/html");
     this->setHTTPHeader("Content-Length", std::to_string(html.size()));
-    this->body = html;
-    std::string preparedRequest = prepareRequest();
-    // now send it in the response
-    send(connfd, preparedRequest.c_str(), preparedRequest.size(), 0);
-};
\ No newline at end of file
+    // now send it in the response, the body is moved, not copied
+    writeResponse(std::move(html));
+};
+
+void Response::sendJSON(std::string json, int statusCode)
+{
+    status = statusLine(statusCode);
+    this->setHTTPHeader("Content-Type", "application/json");
+    this->setHTTPHeader("Content-Length", std::to_string(json.size()));
+    writeResponse(std::move(json));
+};
+
+void Response::sendHTML(std::string_view html, int statusCode)
+{
+    sendHTML(std::string(html), statusCode);
+}
+
+void Response::sendHTML(const char *html, int statusCode)
+{
+    sendHTML(std::string(html), statusCode);
+}
+
+void Response::sendJSON(std::string_view json, int statusCode)
+{
+    sendJSON(std::string(json), statusCode);
+}
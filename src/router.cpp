@@ -0,0 +1,199 @@
+#include "router.hpp"
+#include "logger.hpp"
+#include <cstring>
+
+void Router::clear()
+{
+    trees.clear();
+    routes.clear();
+}
+
+// Walks or creates the static path for text below node, splitting an existing
+// edge where the text diverges from it. Returns the node the text ends on.
+Router::Node *Router::insertStatic(Node *node, const std::string &text)
+{
+    size_t i = 0;
+    while (i < text.size())
+    {
+        Node *next = nullptr;
+        for (auto &child : node->children)
+        {
+            if (child->prefix[0] == text[i])
+            {
+                next = child.get();
+                break;
+            }
+        }
+
+        if (!next)
+        {
+            auto child = std::make_unique<Node>();
+            child->prefix = text.substr(i);
+            node->children.push_back(std::move(child));
+            return node->children.back().get();
+        }
+
+        // length of the common prefix between the edge and what is left of the text
+        size_t common = 0;
+        while (common < next->prefix.size() && i + common < text.size() && next->prefix[common] == text[i + common])
+            common++;
+
+        if (common < next->prefix.size())
+        {
+            // split: next keeps the tail of its edge below a new node holding the shared part
+            auto tail = std::make_unique<Node>();
+            tail->prefix = next->prefix.substr(common);
+            tail->children = std::move(next->children);
+            tail->paramChild = std::move(next->paramChild);
+            tail->wildcardChild = std::move(next->wildcardChild);
+            tail->route = next->route;
+
+            next->prefix.resize(common);
+            next->children.clear();
+            next->children.push_back(std::move(tail));
+            next->route = nullptr;
+        }
+
+        node = next;
+        i += common;
+    }
+    return node;
+}
+
+void Router::add(const std::string &method, const std::string &pattern, Handler handler, bool offload)
+{
+    auto entry = std::make_unique<RouteEntry>();
+    entry->id = routes.size();
+    entry->method = method;
+    entry->pattern = pattern;
+    entry->handler = std::move(handler);
+    entry->offload = offload;
+
+    // split the pattern first, a rejected route must not leave nodes behind
+    enum class Piece
+    {
+        STATIC,
+        PARAM,
+        WILDCARD
+    };
+    std::vector<std::pair<Piece, std::string>> pieces;
+    size_t i = 0;
+    while (i < pattern.size())
+    {
+        if (pattern[i] == ':')
+        {
+            size_t end = pattern.find('/', i);
+            if (end == std::string::npos)
+                end = pattern.size();
+            entry->paramNames.push_back(pattern.substr(i + 1, end - i - 1));
+            pieces.push_back({Piece::PARAM, ""});
+            i = end;
+        }
+        else if (pattern[i] == '*')
+        {
+            std::string name = pattern.substr(i + 1);
+            entry->paramNames.push_back(name.empty() ? "*" : name);
+            pieces.push_back({Piece::WILDCARD, ""});
+            i = pattern.size();
+        }
+        else
+        {
+            size_t end = pattern.find_first_of(":*", i);
+            if (end == std::string::npos)
+                end = pattern.size();
+            pieces.push_back({Piece::STATIC, pattern.substr(i, end - i)});
+            i = end;
+        }
+    }
+
+    if (entry->paramNames.size() > (size_t)RouteMatch::MAX_PARAMS)
+    {
+        logger.error("Route " + pattern + " has too many params, skipping it");
+        return;
+    }
+
+    auto &root = trees[method];
+    if (!root)
+        root = std::make_unique<Node>();
+    Node *node = root.get();
+
+    for (auto &piece : pieces)
+    {
+        if (piece.first == Piece::PARAM)
+        {
+            if (!node->paramChild)
+                node->paramChild = std::make_unique<Node>();
+            node = node->paramChild.get();
+        }
+        else if (piece.first == Piece::WILDCARD)
+        {
+            if (!node->wildcardChild)
+                node->wildcardChild = std::make_unique<Node>();
+            node = node->wildcardChild.get();
+        }
+        else
+            node = insertStatic(node, piece.second);
+    }
+
+    if (node->route)
+        logger.warn("Route " + method + " " + pattern + " shadows " + node->route->pattern);
+
+    node->route = entry.get();
+    routes.push_back(std::move(entry));
+}
+
+bool Router::matchNode(const Node *node, const char *path, size_t length, size_t position, RouteMatch &result)
+{
+    if (position == length && node->route)
+    {
+        result.route = node->route;
+        return true;
+    }
+
+    if (position < length)
+    {
+        // ---- static, at most one child can start with this byte
+        for (auto &child : node->children)
+        {
+            const std::string &prefix = child->prefix;
+            if (prefix[0] != path[position])
+                continue;
+            if (length - position >= prefix.size() && memcmp(path + position, prefix.data(), prefix.size()) == 0 &&
+                matchNode(child.get(), path, length, position + prefix.size(), result))
+                return true;
+            break;
+        }
+
+        // ---- :param, one non-empty segment
+        if (node->paramChild && path[position] != '/' && result.paramCount < RouteMatch::MAX_PARAMS)
+        {
+            const char *slash = (const char *)memchr(path + position, '/', length - position);
+            size_t end = slash ? slash - path : length;
+
+            int saved = result.paramCount;
+            result.params[result.paramCount++] = {(uint32_t)position, (uint32_t)(end - position)};
+            if (matchNode(node->paramChild.get(), path, length, end, result))
+                return true;
+            result.paramCount = saved;
+        }
+    }
+
+    // ---- * takes whatever is left
+    if (node->wildcardChild && node->wildcardChild->route && result.paramCount < RouteMatch::MAX_PARAMS)
+    {
+        result.params[result.paramCount++] = {(uint32_t)position, (uint32_t)(length - position)};
+        result.route = node->wildcardChild->route;
+        return true;
+    }
+    return false;
+}
+
+bool Router::match(std::string_view method, std::string_view path, RouteMatch &result) const
+{
+    auto tree = trees.find(std::string(method));
+    if (tree == trees.end())
+        return false;
+
+    result.paramCount = 0;
+    return matchNode(tree->second.get(), path.data(), path.size(), 0, result);
+}
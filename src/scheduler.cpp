@@ -0,0 +1,219 @@
+#include "scheduler.hpp"
+#include "logger.hpp"
+#include <thread>
+
+static const int64_t INITIAL_CAPACITY = 256;
+
+// the deque the calling thread pushes onto, set by attach() and for workers
+static thread_local WorkDeque *ownDeque = nullptr;
+static thread_local bool worker = false;
+
+WorkDeque::Ring::Ring(int64_t capacity) : capacity(capacity), slots(new std::atomic<Task *>[capacity]) {}
+
+WorkDeque::WorkDeque()
+{
+    rings.push_back(std::make_unique<Ring>(INITIAL_CAPACITY));
+    ring.store(rings.back().get(), std::memory_order_relaxed);
+}
+
+WorkDeque::~WorkDeque() = default;
+
+// Orderings follow Lê et al., "Correct and Efficient Work-Stealing for Weak
+// Memory Models" (PPoPP 2013).
+void WorkDeque::push(Task *task)
+{
+    int64_t b = bottom.load(std::memory_order_relaxed);
+    int64_t t = top.load(std::memory_order_acquire);
+    Ring *current = ring.load(std::memory_order_relaxed);
+
+    if (b - t > current->capacity - 1)
+    {
+        auto grown = std::make_unique<Ring>(current->capacity * 2);
+        for (int64_t i = t; i < b; i++)
+        {
+            grown->put(i, current->get(i));
+        }
+        current = grown.get();
+        rings.push_back(std::move(grown));
+        ring.store(current, std::memory_order_release);
+    }
+
+    current->put(b, task);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom.store(b + 1, std::memory_order_relaxed);
+}
+
+Task *WorkDeque::pop()
+{
+    int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+    Ring *current = ring.load(std::memory_order_relaxed);
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top.load(std::memory_order_relaxed);
+
+    if (t > b)
+    {
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    Task *task = current->get(b);
+    if (t == b)
+    {
+        // the last one, a thief may be taking it at the same time
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            task = nullptr;
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return task;
+}
+
+Task *WorkDeque::steal()
+{
+    int64_t t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom.load(std::memory_order_acquire);
+    if (t >= b)
+        return nullptr;
+
+    Task *task = ring.load(std::memory_order_acquire)->get(t);
+    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        return nullptr;
+    return task;
+}
+
+bool WorkDeque::empty() const
+{
+    return top.load(std::memory_order_acquire) >= bottom.load(std::memory_order_acquire);
+}
+
+// Deques are never freed, like the detached workers that scan them they live
+// as long as the process.
+WorkDeque *Scheduler::addDeque()
+{
+    int index = dequeCount.fetch_add(1);
+    if (index >= MAX_DEQUES)
+    {
+        logger.fatal("Scheduler supports at most " + std::to_string(MAX_DEQUES) + " loops and workers");
+        exit(1);
+    }
+    WorkDeque *deque = new WorkDeque();
+    deques[index].store(deque, std::memory_order_release);
+    return deque;
+}
+
+void Scheduler::start(int threads)
+{
+    for (int i = 0; i < threads; i++)
+    {
+        std::thread t(&Scheduler::workerLoop, this, addDeque());
+        t.detach();
+    }
+    workerCount = threads;
+    logger.info("Offload scheduler started with " + std::to_string(threads) + " workers");
+}
+
+void Scheduler::attach()
+{
+    if (!ownDeque)
+        ownDeque = addDeque();
+}
+
+void Scheduler::submit(Task *task)
+{
+    if (ownDeque)
+        ownDeque->push(task);
+    else
+    {
+        std::lock_guard<std::mutex> lock(injectMutex);
+        injected.push_back(task);
+        injectedCount.fetch_add(1);
+    }
+
+    // pairs with the increment in idle(): either the worker sees the task or we see it sleeping
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.load(std::memory_order_relaxed) > 0)
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        wakeup.notify_one();
+    }
+}
+
+Task *Scheduler::find(WorkDeque *own, uint64_t &seed)
+{
+    if (Task *task = own->pop())
+        return task;
+
+    // xorshift, so idle workers don't all hammer the same victim
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+
+    int count = dequeCount.load(std::memory_order_acquire);
+    int start = seed % count;
+    for (int i = 0; i < count; i++)
+    {
+        WorkDeque *victim = deques[(start + i) % count].load(std::memory_order_acquire);
+        if (!victim || victim == own)
+            continue;
+        if (Task *task = victim->steal())
+            return task;
+    }
+
+    if (injectedCount.load(std::memory_order_relaxed) > 0)
+    {
+        std::lock_guard<std::mutex> lock(injectMutex);
+        if (!injected.empty())
+        {
+            Task *task = injected.front();
+            injected.pop_front();
+            injectedCount.fetch_sub(1);
+            return task;
+        }
+    }
+    return nullptr;
+}
+
+// true when nothing is queued anywhere, checked with sleeping already raised
+bool Scheduler::idle()
+{
+    if (injectedCount.load() > 0)
+        return false;
+
+    int count = dequeCount.load(std::memory_order_acquire);
+    for (int i = 0; i < count; i++)
+    {
+        WorkDeque *deque = deques[i].load(std::memory_order_acquire);
+        if (deque && !deque->empty())
+            return false;
+    }
+    return true;
+}
+
+bool Scheduler::onWorker()
+{
+    return worker;
+}
+
+void Scheduler::workerLoop(WorkDeque *own)
+{
+    ownDeque = own;
+    worker = true;
+    uint64_t seed = (uint64_t)(uintptr_t)own | 1;
+
+    while (true)
+    {
+        if (Task *task = find(own, seed))
+        {
+            task->run();
+            continue;
+        }
+
+        // a steal can lose a race against a non-empty deque, only sleep once everything is empty
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleeping.fetch_add(1);
+        if (idle())
+            wakeup.wait(lock);
+        sleeping.fetch_sub(1);
+    }
+}
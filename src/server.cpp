@@ -3,11 +3,12 @@
 #include "request.hpp"
 #include "response.hpp"
 #include "logger.hpp"
+#include "simd.hpp"
+#include "upgrade.hpp"
 #include <filesystem>
 #include <arpa/inet.h>
-
-std::mutex mtx;
-std::condition_variable cv;
+#include <sys/eventfd.h>
+#include <poll.h>
 
 Server::Server(int NOT, int PORT)
 {
@@ -41,245 +42,150 @@ Server::Server(int NOT, int PORT)
 
 Server::~Server() {};
 
-void Server::worker(std::vector<int> &conns, Server *server)
+void Server::handle(Request &request, Response &response)
 {
-
-    while (true)
+    if (RateLimitEnabled)
     {
-        int connfd;
-
+        int retryAfter = 0;
+        if (!rateLimiter.allow(request.peer, retryAfter))
         {
-            std::unique_lock<std::mutex> lock(mtx);
+            response.setHTTPHeader("Retry-After", std::to_string(retryAfter));
+            response.sendHTML("", 429);
+            return;
+        }
+    }
 
-            cv.wait(lock, [&conns]
-                    { return conns.size() > 0; });
+    // ---- CORS SETUP -----
+    // so if we get a OPTIONS request, send the response with some set headers.
 
-            // std::cout << "Thread " << std::this_thread::get_id()
-            //           << " handling request\n"
-            //           << std::flush;
+    // apply cors headers to all responses
+    for (auto &it : CORS)
+    {
+        response.setHTTPHeader(it.first, it.second);
+    }
 
-            connfd = conns.back();
-            conns.pop_back();
-        }
+    response.acceptEncoding = request.header("Accept-Encoding");
+    response.ifNoneMatch = request.header("If-None-Match");
+    response.ifModifiedSince = request.header("If-Modified-Since");
+    response.range = request.header("Range");
+    response.ifRange = request.header("If-Range");
+    response.headOnly = request.method() == "HEAD";
 
-        // -- We have the connection, use that to get the IP
-        sockaddr_in peeraddr;
-        socklen_t peeraddr_len = sizeof(peeraddr);
-        getpeername(connfd, (sockaddr *)&peeraddr, &peeraddr_len);
-        char ip[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &(peeraddr.sin_addr), ip, INET_ADDRSTRLEN);
-        struct timeval timeout;
-        timeout.tv_sec = server->CONNECTION_TIMEOUT; // 5 seconds
-        timeout.tv_usec = 0;
-        setsockopt(connfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-
-        int requestCount{0};
-        time_t start_timestamp = std::time(nullptr);
-        time_t rolling_timestamp = std::time(nullptr);
-
-        // loop to keep connections as supported in HTTP/1.1
-        while (requestCount <= server->CONNECTION_MAX_REQUESTS)
-        {
+    if (request.method() == "OPTIONS")
+    {
+        response.sendHTML("", 204);
+        return;
+    }
 
-            // request buffer
-            Request request{connfd};
-            Response response{connfd};
-            response.setHTTPHeader("Connection", "keep-alive");
-            response.setHTTPHeader("Keep-Alive", "timeout=" + std::to_string(server->CONNECTION_TIMEOUT) + ", max=" + std::to_string(server->CONNECTION_MAX_REQUESTS - requestCount));
+    // ---- Middleware execution before the main handler
+    {
+        bool executeNext = true;
 
-            requestCount++;
+        for (Middleware func : middlewares)
+        {
+            executeNext = false;
 
-            // so rolling timestamp checks the time of inactivity on the connection
-            if (request.data.method.empty())
-            {
-                rolling_timestamp = std::time(nullptr);
-                // close(connfd);
-                break;
-            }
+            func(request, response, [&executeNext]()
+                 { executeNext = true; });
 
-            // -- Set IP in the request
-            std::string req_ip{ip, INET_ADDRSTRLEN};
-            request.data.ip = req_ip;
+            if (!executeNext)
+                break;
+        }
 
-            auto rateLimit_it = server->rateLimitBucket.find(req_ip);
-            std::time_t now = std::time(nullptr);
+        // if the last middleware didnt call next, we just leave the request there
+        if (!executeNext)
+            return;
+    }
 
-            if (server->RateLimitEnabled)
-            {
-                if ((rateLimit_it != server->rateLimitBucket.end()))
-                {
-                    if (rateLimit_it->second.second <= 0 && now - rateLimit_it->second.first < server->REQUEST_LIMIT_WINDOW)
-                    {
-                        response.sendHTML("", 429);
-                        continue;
-                    }
-                    else if (rateLimit_it->second.second <= 0 && now - rateLimit_it->second.first >= server->REQUEST_LIMIT_WINDOW)
-                    {
-                        rateLimit_it->second.second = server->REQUEST_LIMIT;
-                        logger.debug("Rate limit window reset for IP: " + req_ip);
-                    }
-                    else
-                    {
-                        rateLimit_it->second.second -= 1;
-                    }
-                }
-                else
-                {
-                    server->rateLimitBucket[req_ip] = {now, server->REQUEST_LIMIT};
-                }
-            }
-
-            // ---- CHECK REQUEST BODY SIZE
-            if (!request.data.headers["Content-Length"].empty() && std::stoi(request.data.headers["Content-Length"]) > server->REQUEST_BODY_SIZE_LIMIT)
-            {
-                response.sendHTML("", 413);
-                continue;
-            }
+    // ---- Route Matching ----
+    RouteMatch match;
+    bool routeExists = router.match(request.method(), request.path(), match);
+    // HEAD runs the GET handler unless it has its own route, the response drops the body
+    if (!routeExists && response.headOnly)
+        routeExists = router.match("GET", request.path(), match);
 
-            // ---- CORS SETUP -----
-            // so if we get a OPTIONS request, send the response with some set headers.
+    if (routeExists)
+    {
+        // fill in the params before the function execution
+        const RouteEntry &route = *match.route;
+        request.route = match.route;
 
-            // apply cors headers to all responses
-            for (auto &it : server->CORS)
-            {
-                response.setHTTPHeader(it.first, it.second);
-            }
+        // offloaded() decides before the middlewares run, say so if it ever misses
+        if (route.offload && !Scheduler::onWorker())
+        {
+            static std::atomic<bool> reported{false};
+            if (!reported.exchange(true))
+                logger.warn("Offloaded route " + route.method + " " + route.pattern + " ran on an I/O loop");
+        }
+        std::string_view path = request.path();
+        for (int i = 0; i < match.paramCount; i++)
+        {
+            std::string_view value = path.substr(match.params[i].offset, match.params[i].length);
+            if (request.zeroCopy)
+                request.view.params.push_back({route.paramNames[i], value});
+            else
+                request.data.params.insert_or_assign(std::pmr::string(route.paramNames[i], request.data.params.get_allocator()), value);
+        }
+        route.handler(request, response);
+    }
 
-            if (request.data.method == "OPTIONS")
-            {
-                response.sendHTML("", 204);
-                continue;
-            }
+    // if route does not exists, just exit the loop 
+    if (!routeExists){
+        response.sendHTML("<h1>404 Not Found!</h1>", 404);
+    }
 
-            // ---- Middleware execution before the main handler
-            {
-                bool executeNext = true;
-
-                for (Middleware func : server->middlewares)
-                {
-                    executeNext = false;
-
-                    func(request, response, [&executeNext]()
-                         { executeNext = true; });
-
-                    if (!executeNext)
-                        break;
-                }
-
-                // if the last middleware didnt call next, we just leave the request there
-                if (!executeNext)
-                    continue;
-            }
-
-            // ---- Route Matching ----
-            auto it = server->pathMap.find({request.data.path, request.data.method});
-            bool dynamicParams = false;
-            size_t colonForDP = request.data.path.find_first_of(":");
-            if (colonForDP != std::string::npos)
-                dynamicParams = true;
-
-            // fill in the params becfore the function execution
-            bool routeExists = false;
-            for (auto &it : server->pathMap)
-            {
-                bool dynamicRoute = false;
-                std::string method = it.first.second;
-                std::string route = it.first.first;
-                size_t colon = route.find_first_of(":");
-
-                // dynamic route check
-                if (colon != std::string::npos)
-                    dynamicRoute = true;
-
-                // /usr/:id/role/:role
-                // /usr/2/role/admin
-                if (dynamicRoute)
-                {
-
-                    // ---Check the path and the method
-                    if (request.data.path.substr(0, colon - 1) != route.substr(0, colon - 1))
-                        continue;
-                    if (request.data.method != it.first.second)
-                        continue;
-
-                    // --- PARAM Extraction
-
-                    int i = colon; // path
-                    int j = colon; // route
-                    while (i < request.data.path.length() && j < route.length())
-                    {
-                        size_t nextSlashInPath = request.data.path.find_first_of("/", i);
-                        size_t nextSlashInRoute = route.find_first_of("/", j);
-
-                        if (nextSlashInRoute == std::string::npos)
-                        {
-                            // nextSlashInPath = request.data.path.length();
-                            nextSlashInRoute = route.length();
-                        }
-
-                        // check if this one is a param or simple route
-                        if (route[j] != ':' && request.data.path.substr(i, nextSlashInPath - i) == route.substr(j, nextSlashInRoute - j))
-                        {
-                            i = nextSlashInPath + 1;
-                            j = nextSlashInRoute + 1;
-                            continue;
-                        }
-
-                        // if (nextSlashInPath == std::string::npos){
-                        //     nextSlashInPath = request.data.path.length();
-                        // }
-
-                        std::string value = request.data.path.substr(i, nextSlashInPath - i);
-                        std::string key = route.substr(j + 1, nextSlashInRoute - j - 1);
-                        request.data.params[key] = value;
-
-                        // std::cout << "[DEBUG] Extracted param: " << key << " = " << value << "\n";
-
-                        i = nextSlashInPath + 1;
-                        j = nextSlashInRoute + 1;
-                    }
-
-                    // ---- Function Calling
-                    it.second(request, response);
-                    routeExists = true;
-                    break;
-                }
-                else
-                {
-                    // just check if the route matches
-                    if (request.data.path == route && request.data.method == it.first.second){
-                        it.second(request, response);
-                        routeExists = true;
-                        break;
-                    }
-                    else
-                        continue;
-                }
-            }
-
-            // if route does not exists, just exit the loop 
-            if (!routeExists){
-                response.sendHTML("<h1>404 Not Found!</h1>", 404);
-                logger.request(request.data.method, request.data.path, response.status);
-            }
-
-            logger.request(request.data.method, request.data.path, response.status);
-
-            // if connection set to close, just close it else just keep reading
-            if (request.data.headers["Connection"] == "close")
-                break;
-        }
+    logger.request(request.method(), request.path(), response.status);
+}
 
-        // so when you are out of the loop, it simply means this connection needs to be closed
-        close(connfd);
-        logger.debug("Closing the Connection for IP: " + std::string(ip));
+// Builds the radix trees from pathMap, routes registered after start() are not served
+void Server::compileRoutes()
+{
+    // a route of the same path registered by the application wins
+    if (METRICS && !METRICS_PATH.empty() && !pathMap.count({METRICS_PATH, "GET"}))
+        pathMap[{METRICS_PATH, "GET"}] = [this](Request &req, Response &res)
+        { serveMetrics(req, res); };
+
+    router.clear();
+    offloading = false;
+    for (auto &it : pathMap)
+    {
+        bool offload = offloadedRoutes.count(it.first) > 0;
+        router.add(it.first.second, it.first.first, it.second, offload);
+        offloading |= offload;
     }
+    logger.debug("Compiled " + std::to_string(pathMap.size()) + " routes");
+    metrics.configure(router.size());
 }
 
-void Server::start()
+static bool loopback(const PeerKey &peer)
 {
+    static const uint8_t v6[16] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+    static const uint8_t mapped[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+    if (memcmp(peer.bytes, v6, 16) == 0)
+        return true;
+    return memcmp(peer.bytes, mapped, 12) == 0 && peer.bytes[12] == 127;
+}
 
-    int server_socket = socket(AF_INET, SOCK_STREAM, 0);
+void Server::serveMetrics(Request &request, Response &response)
+{
+    if (METRICS_LOCAL_ONLY && !loopback(request.peer))
+    {
+        response.sendHTML("<h1>404 Not Found!</h1>", 404);
+        return;
+    }
+
+    std::string body = metrics.render(router);
+    response.status = Response::statusLine(200);
+    response.setHTTPHeader("Content-Type", "text/plain; version=0.0.4; charset=utf-8");
+    response.setHTTPHeader("Cache-Control", "no-store");
+    response.setHTTPHeader("Content-Length", std::to_string(body.size()));
+    response.writeResponse(std::move(body));
+}
+
+int Server::openListener(bool reusePort)
+{
+    // always non-blocking: after an upgrade the other process accepts from the same socket
+    int server_socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (server_socket < 0)
     {
         logger.fatal("Failed to create socket");
@@ -296,6 +202,13 @@ void Server::start()
     }
     logger.debug("Socket option SO_REUSEADDR enabled");
 
+    // every loop binds the same port, the kernel hashes new connections across them
+    if (reusePort && setsockopt(server_socket, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
+    {
+        logger.fatal("Failed to set socket options (SO_REUSEPORT)");
+        exit(1);
+    }
+
     sockaddr_in sock_addr{};
     sock_addr.sin_family = AF_INET;
     sock_addr.sin_port = htons(PORT);
@@ -307,41 +220,233 @@ void Server::start()
         exit(1);
     }
 
-    logger.info("Server listening on port " + std::to_string(PORT));
-
     listen(server_socket, SOMAXCONN);
+    return server_socket;
+}
 
-    sockaddr_in peer_addr{};
-    socklen_t peer_addr_len = sizeof(peer_addr);
+int Server::listener(bool reusePort)
+{
+    int fd;
+    if (!inherited.empty())
+    {
+        fd = inherited.front();
+        inherited.erase(inherited.begin());
+    }
+    else
+        fd = openListener(reusePort);
+    listeners.push_back(fd);
+    return fd;
+}
 
-    // initialise the thread pool
+// Listeners the replaced process had beyond what this configuration uses, e.g.
+// more SO_REUSEPORT shards. The kernel keeps queueing connections on them, so
+// they are spread over the loops rather than left to fill up.
+void Server::adoptInherited()
+{
+    for (size_t i = 0; !inherited.empty(); i++)
+    {
+        int fd = listener(true);
+        if (!uringLoops.empty())
+            uringLoops[i % uringLoops.size()]->listenOn(fd);
+        else
+            loops[i % loops.size()]->listenOn(fd);
+    }
+}
 
+// Every listener is open and the loops run: the replaced process can stop
+// accepting, and from now on SIGUSR2 replaces this one.
+void Server::accepting()
+{
+    logger.info("Server ready - accepting connections");
+    upgrade::ready();
+    if (HOT_UPGRADE)
+    {
+        std::thread t(&Server::upgradeLoop, this);
+        t.detach();
+    }
+}
+
+void Server::upgradeLoop()
+{
+    while (true)
+    {
+        upgrade::requested();
+        logger.info("Upgrade requested, starting the new binary");
+        if (upgrade::handOff(listeners, UPGRADE_TIMEOUT))
+            break;
+    }
+
+    // the new process accepts, ours stop and close their connections as they go idle
+    draining = true;
+    for (auto &loop : loops)
+    {
+        loop->wake();
+    }
+    for (auto &loop : uringLoops)
+    {
+        loop->wake();
+    }
+    if (drainfd >= 0)
+    {
+        uint64_t one = 1;
+        ssize_t ignored = write(drainfd, &one, sizeof(one));
+        (void)ignored;
+    }
+
+    size_t total = loops.size() + uringLoops.size();
+    std::unique_lock<std::mutex> lock(drainMutex);
+    if (!drainCondition.wait_for(lock, std::chrono::seconds(DRAIN_TIMEOUT), [&]
+                                 { return drainedLoops == total; }))
+        logger.warn("Drain timed out, closing the remaining connections");
+    logger.info("Drained, exiting");
+
+    // The loops and scheduler workers never return, exit() would run static
+    // destructors (the logger's included) under their feet. Nothing is left
+    // to clean up that the kernel doesn't.
+    logger.flush();
+    _exit(0);
+}
+
+void Server::loopDrained()
+{
+    std::lock_guard<std::mutex> lock(drainMutex);
+    drainedLoops++;
+    drainCondition.notify_all();
+}
+
+bool Server::startUring()
+{
     int N = NOT;
 
-    std::vector<int> conns;
+    for (int i = 0; i < N; i++)
+    {
+        uringLoops.push_back(std::make_unique<UringLoop>(this));
+        if (!uringLoops.back()->init())
+        {
+            uringLoops.clear();
+            return false;
+        }
+    }
+
+    // every ring runs its own multishot accept, on a shared listener unless sharded
+    int shared = REUSE_PORT ? -1 : listener(false);
+    for (auto &loop : uringLoops)
+    {
+        loop->listenOn(REUSE_PORT ? listener(true) : shared);
+    }
+    adoptInherited();
+    logger.info("Server listening on port " + std::to_string(PORT) + " (io_uring)");
+
+    for (int i = 1; i < N; i++)
+    {
+        std::thread t(&UringLoop::run, uringLoops[i].get());
+        t.detach();
+    }
+    logger.info("io_uring loops initialized with " + std::to_string(N) + " threads");
+    accepting();
+
+    uringLoops[0]->run();
+    return true;
+}
+
+void Server::start()
+{
+    // before any listener is opened, so a replacement reuses the sockets of the process it replaces
+    inherited = upgrade::inherit();
+    if (HOT_UPGRADE)
+        upgrade::watchSignal();
+
+    compileRoutes();
+    logger.debug(std::string("Request parser scanning with ") + simd::levelName(simd::level()));
+    rateLimiter.configure(REQUEST_LIMIT, REQUEST_LIMIT_WINDOW, RATE_LIMIT_MAX_ENTRIES);
+    if (offloading)
+        scheduler.start(OFFLOAD_THREADS > 0 ? OFFLOAD_THREADS : std::max(1u, std::thread::hardware_concurrency()));
+
+    if (ASSET_CACHE_BUDGET > 0)
+        assets.load("public", ASSET_CACHE_BUDGET, ASSET_CACHE_MAX_FILE_SIZE);
+    if (COMPRESSION_BUDGET > 0)
+        assets.compress("public", COMPRESSION_BUDGET, COMPRESSION_MAX_FILE_SIZE);
+
+    if (IO_BACKEND == IOBackend::IO_URING)
+    {
+        if (startUring())
+            return;
+        logger.warn("io_uring is not available on this kernel, falling back to epoll");
+    }
+
+    // start one event loop per thread, each multiplexes its own set of connections
+    int N = NOT;
 
-    // start the threads
     for (int i = 0; i < N; i++)
     {
-        std::thread t(worker, std::ref(conns), this);
+        loops.push_back(std::make_unique<EventLoop>(this));
+    }
+
+    if (REUSE_PORT)
+    {
+        // ---- Sharded accept: no acceptor thread, no shared queue
+        for (auto &loop : loops)
+        {
+            loop->listenOn(listener(true));
+        }
+        adoptInherited();
+        logger.info("Server listening on port " + std::to_string(PORT) + " with " + std::to_string(N) + " SO_REUSEPORT listeners");
+
+        for (int i = 1; i < N; i++)
+        {
+            std::thread t(&EventLoop::run, loops[i].get());
+            t.detach();
+        }
+        logger.info("Event loops initialized with " + std::to_string(N) + " threads");
+        accepting();
+
+        // the calling thread becomes the first loop
+        loops[0]->run();
+        return;
+    }
+
+    int server_socket = listener(false);
+    adoptInherited();
+    logger.info("Server listening on port " + std::to_string(PORT));
+
+    for (auto &loop : loops)
+    {
+        std::thread t(&EventLoop::run, loop.get());
         t.detach();
     }
-    logger.info("Thread pool initialized with " + std::to_string(N) + " workers");
+    logger.info("Event loops initialized with " + std::to_string(N) + " threads");
 
-    logger.info("Server ready - accepting connections");
+    sockaddr_in peer_addr{};
+    socklen_t peer_addr_len = sizeof(peer_addr);
+    size_t next = 0;
+
+    drainfd = eventfd(0, EFD_CLOEXEC);
+    pollfd waitFor[2] = {{server_socket, POLLIN, 0}, {drainfd, POLLIN, 0}};
+
+    accepting();
     while (true)
     {
+        if (poll(waitFor, 2, -1) <= 0)
+            continue;
+        if (waitFor[1].revents)
+        {
+            // upgraded, the loops finish their connections and upgradeLoop() exits
+            while (true)
+                pause();
+        }
 
-        int connfd = accept(server_socket, (sockaddr *)&peer_addr, &peer_addr_len);
+        int connfd = accept4(server_socket, (sockaddr *)&peer_addr, &peer_addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
         if (connfd < 0)
         {
-            logger.error("Failed to accept connection");
+            // another process sharing the listener got there first
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                logger.error("Failed to accept connection");
             continue;
         }
 
-        std::lock_guard<std::mutex> lock(mtx);
-        conns.push_back(connfd);
-        cv.notify_one();
+        // round robin the new connection onto a loop
+        loops[next]->addConnection(connfd);
+        next = (next + 1) % loops.size();
     }
 }
 
@@ -364,6 +469,22 @@ void Server::use(Middleware func)
     middlewares.push_back(func);
 }
 
+void Server::offload(std::string route, std::string method)
+{
+    offloadedRoutes.insert({route, method});
+}
+
+bool Server::offloaded(const Request &request) const
+{
+    // decided before the middlewares run, on the path they will leave behind
+    std::string_view path = request.routePath();
+    RouteMatch match;
+    bool found = router.match(request.method(), path, match);
+    if (!found && request.method() == "HEAD")
+        found = router.match("GET", path, match);
+    return found && match.route->offload;
+}
+
 void Server::get(std::string route, std::function<void(Request &req, Response &res)> callback)
 {
     this->registerRoute(route, "GET", callback);
@@ -0,0 +1,266 @@
+#include "simd.hpp"
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86 1
+#endif
+
+namespace simd
+{
+    // ---- Scalar reference, also handles the tails of the vector kernels
+
+    // RFC 9110 tchar as 16 masks, one per low nibble, bit h set when (h << 4 | low) is a tchar.
+    // Row: high nibble 0..7, anything >= 0x80 is never a tchar.
+    static const uint8_t TOKEN_LOW[16] = {
+        0xe8, // 0x30 '0', 0x50 'P', 0x60 '`', 0x70 'p'
+        0xfc, // '!' '1' 'A' 'Q' 'a' 'q'
+        0xf8, // '2' 'B' 'R' 'b' 'r'
+        0xfc, // '#' '3' 'C' 'S' 'c' 's'
+        0xfc, // '$' '4' 'D' 'T' 'd' 't'
+        0xfc, // '%' '5' 'E' 'U' 'e' 'u'
+        0xfc, // '&' '6' 'F' 'V' 'f' 'v'
+        0xfc, // '\'' '7' 'G' 'W' 'g' 'w'
+        0xf8, // '8' 'H' 'X' 'h' 'x'
+        0xf8, // '9' 'I' 'Y' 'i' 'y'
+        0xf4, // '*' 'J' 'Z' 'j' 'z'
+        0x54, // '+' 'K' 'k'
+        0xd0, // 'L' 'l' '|'
+        0x54, // '-' 'M' 'm'
+        0xf4, // '.' 'N' '^' 'n' '~'
+        0x70, // 'O' '_' 'o'
+    };
+
+    static inline bool isToken(unsigned char c)
+    {
+        return c < 0x80 && (TOKEN_LOW[c & 0xf] >> (c >> 4) & 1);
+    }
+
+    static size_t scanTokenScalar(const char *data, size_t size)
+    {
+        size_t i = 0;
+        while (i < size && isToken((unsigned char)data[i]))
+            i++;
+        return i;
+    }
+
+    static size_t scanValueScalar(const char *data, size_t size)
+    {
+        size_t i = 0;
+        for (; i < size; i++)
+        {
+            unsigned char c = data[i];
+            if ((c < 0x20 && c != '\t') || c == 0x7f)
+                break;
+        }
+        return i;
+    }
+
+    static size_t scanTargetScalar(const char *data, size_t size)
+    {
+        size_t i = 0;
+        for (; i < size; i++)
+        {
+            unsigned char c = data[i];
+            if (c <= 0x20 || c == 0x7f)
+                break;
+        }
+        return i;
+    }
+
+#ifdef SIMD_X86
+    // ---- SSE2, 16 bytes per step. Unsigned compares are done by flipping the sign bit.
+
+    static size_t scanValueSSE2(const char *data, size_t size)
+    {
+        const __m128i bias = _mm_set1_epi8((char)0x80);
+        const __m128i space = _mm_set1_epi8((char)(0x20 ^ 0x80));
+        const __m128i tab = _mm_set1_epi8('\t');
+        const __m128i del = _mm_set1_epi8(0x7f);
+
+        size_t i = 0;
+        for (; i + 16 <= size; i += 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+            __m128i ctl = _mm_cmplt_epi8(_mm_xor_si128(v, bias), space);
+            ctl = _mm_andnot_si128(_mm_cmpeq_epi8(v, tab), ctl);
+            int mask = _mm_movemask_epi8(_mm_or_si128(ctl, _mm_cmpeq_epi8(v, del)));
+            if (mask)
+                return i + __builtin_ctz(mask);
+        }
+        return i + scanValueScalar(data + i, size - i);
+    }
+
+    static size_t scanTargetSSE2(const char *data, size_t size)
+    {
+        const __m128i bias = _mm_set1_epi8((char)0x80);
+        const __m128i bound = _mm_set1_epi8((char)(0x21 ^ 0x80));
+        const __m128i del = _mm_set1_epi8(0x7f);
+
+        size_t i = 0;
+        for (; i + 16 <= size; i += 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+            __m128i stop = _mm_or_si128(_mm_cmplt_epi8(_mm_xor_si128(v, bias), bound), _mm_cmpeq_epi8(v, del));
+            int mask = _mm_movemask_epi8(stop);
+            if (mask)
+                return i + __builtin_ctz(mask);
+        }
+        return i + scanTargetScalar(data + i, size - i);
+    }
+
+    // SSE2 has no byte shuffle for the nibble lookup, so the token class is
+    // built from ranges: digits, both letter cases, and the 15 punctuation marks.
+    static size_t scanTokenSSE2(const char *data, size_t size)
+    {
+        size_t i = 0;
+        for (; i + 16 <= size; i += 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+            __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20)); // folds A-Z onto a-z
+            __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+            __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+            __m128i ok = _mm_or_si128(alpha, digit);
+
+            static const char marks[] = "!#$%&'*+-.^_`|~";
+            for (int m = 0; m < 15; m++)
+                ok = _mm_or_si128(ok, _mm_cmpeq_epi8(v, _mm_set1_epi8(marks[m])));
+
+            int mask = ~_mm_movemask_epi8(ok) & 0xffff;
+            if (mask)
+                return i + __builtin_ctz(mask);
+        }
+        return i + scanTokenScalar(data + i, size - i);
+    }
+
+    // ---- AVX2, 32 bytes per step
+
+    __attribute__((target("avx2"))) static size_t scanValueAVX2(const char *data, size_t size)
+    {
+        const __m256i bias = _mm256_set1_epi8((char)0x80);
+        const __m256i space = _mm256_set1_epi8((char)(0x20 ^ 0x80));
+        const __m256i tab = _mm256_set1_epi8('\t');
+        const __m256i del = _mm256_set1_epi8(0x7f);
+
+        size_t i = 0;
+        for (; i + 32 <= size; i += 32)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+            __m256i ctl = _mm256_cmpgt_epi8(space, _mm256_xor_si256(v, bias));
+            ctl = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, tab), ctl);
+            uint32_t mask = _mm256_movemask_epi8(_mm256_or_si256(ctl, _mm256_cmpeq_epi8(v, del)));
+            if (mask)
+                return i + __builtin_ctz(mask);
+        }
+        return i + scanValueSSE2(data + i, size - i);
+    }
+
+    __attribute__((target("avx2"))) static size_t scanTargetAVX2(const char *data, size_t size)
+    {
+        const __m256i bias = _mm256_set1_epi8((char)0x80);
+        const __m256i bound = _mm256_set1_epi8((char)(0x21 ^ 0x80));
+        const __m256i del = _mm256_set1_epi8(0x7f);
+
+        size_t i = 0;
+        for (; i + 32 <= size; i += 32)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+            __m256i stop = _mm256_or_si256(_mm256_cmpgt_epi8(bound, _mm256_xor_si256(v, bias)), _mm256_cmpeq_epi8(v, del));
+            uint32_t mask = _mm256_movemask_epi8(stop);
+            if (mask)
+                return i + __builtin_ctz(mask);
+        }
+        return i + scanTargetSSE2(data + i, size - i);
+    }
+
+    // Nibble lookup: TOKEN_LOW by the low nibble, a one-hot bit by the high
+    // nibble, a byte is a tchar when the two share a bit. Bytes >= 0x80 get no
+    // high bit and so never match.
+    __attribute__((target("avx2"))) static size_t scanTokenAVX2(const char *data, size_t size)
+    {
+        const __m128i low128 = _mm_loadu_si128((const __m128i *)TOKEN_LOW);
+        const __m256i lowTable = _mm256_broadcastsi128_si256(low128);
+        const __m256i highTable = _mm256_setr_epi8(
+            1, 2, 4, 8, 16, 32, 64, (char)128, 0, 0, 0, 0, 0, 0, 0, 0,
+            1, 2, 4, 8, 16, 32, 64, (char)128, 0, 0, 0, 0, 0, 0, 0, 0);
+        const __m256i nibble = _mm256_set1_epi8(0x0f);
+
+        size_t i = 0;
+        for (; i + 32 <= size; i += 32)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+            __m256i low = _mm256_shuffle_epi8(lowTable, _mm256_and_si256(v, nibble));
+            __m256i high = _mm256_shuffle_epi8(highTable, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+            __m256i miss = _mm256_cmpeq_epi8(_mm256_and_si256(low, high), _mm256_setzero_si256());
+            uint32_t mask = _mm256_movemask_epi8(miss);
+            if (mask)
+                return i + __builtin_ctz(mask);
+        }
+        return i + scanTokenScalar(data + i, size - i);
+    }
+#endif
+
+    // ---- Dispatch
+
+    struct Kernels
+    {
+        Level level;
+        size_t (*token)(const char *, size_t);
+        size_t (*value)(const char *, size_t);
+        size_t (*target)(const char *, size_t);
+    };
+
+    static Kernels kernelsFor(Level wanted)
+    {
+#ifdef SIMD_X86
+        __builtin_cpu_init();
+        if (wanted == Level::AVX2 && __builtin_cpu_supports("avx2"))
+            return {Level::AVX2, scanTokenAVX2, scanValueAVX2, scanTargetAVX2};
+        if (wanted != Level::SCALAR)
+            return {Level::SSE2, scanTokenSSE2, scanValueSSE2, scanTargetSSE2};
+#else
+        (void)wanted;
+#endif
+        return {Level::SCALAR, scanTokenScalar, scanValueScalar, scanTargetScalar};
+    }
+
+    static Kernels kernels = kernelsFor(Level::AVX2);
+
+    Level level()
+    {
+        return kernels.level;
+    }
+
+    const char *levelName(Level level)
+    {
+        switch (level)
+        {
+        case Level::AVX2:
+            return "AVX2";
+        case Level::SSE2:
+            return "SSE2";
+        default:
+            return "scalar";
+        }
+    }
+
+    void setLevel(Level level)
+    {
+        kernels = kernelsFor(level);
+    }
+
+    size_t scanToken(const char *data, size_t size)
+    {
+        return kernels.token(data, size);
+    }
+
+    size_t scanValue(const char *data, size_t size)
+    {
+        return kernels.value(data, size);
+    }
+
+    size_t scanTarget(const char *data, size_t size)
+    {
+        return kernels.target(data, size);
+    }
+}
@@ -0,0 +1,71 @@
+#include "stream.hpp"
+#include <cstdio>
+
+ResponseStream::ResponseStream(OutputQueue *out, bool chunked, bool headOnly)
+    : out(out), chunked(chunked), headOnly(headOnly)
+{
+}
+
+void ResponseStream::emit(const char *data, size_t size)
+{
+    out->append(data, size);
+}
+
+void ResponseStream::chunkHeader(size_t size)
+{
+    char header[24];
+    int length = snprintf(header, sizeof(header), "%zx\r\n", size);
+    emit(header, length);
+}
+
+void ResponseStream::write(std::string_view chunk)
+{
+    // an empty chunk would be read as the end of the body
+    if (finished || headOnly || chunk.empty())
+        return;
+
+    if (chunked)
+        chunkHeader(chunk.size());
+    emit(chunk.data(), chunk.size());
+    if (chunked)
+        emit("\r\n", 2);
+}
+
+void ResponseStream::write(std::string &&chunk)
+{
+    if (finished || headOnly || chunk.empty())
+        return;
+
+    if (chunked)
+        chunkHeader(chunk.size());
+    out->appendOwned(std::move(chunk));
+    if (chunked)
+        emit("\r\n", 2);
+}
+
+void ResponseStream::trailer(std::string_view name, std::string_view value)
+{
+    trailers.append(name);
+    trailers += ": ";
+    trailers.append(value);
+    trailers += "\r\n";
+}
+
+void ResponseStream::end()
+{
+    if (finished)
+        return;
+    finished = true;
+    if (headOnly || !chunked)
+        return;
+
+    // last chunk, trailer fields, then the empty line
+    emit("0\r\n", 3);
+    emit(trailers.data(), trailers.size());
+    emit("\r\n", 2);
+}
+
+size_t ResponseStream::queued() const
+{
+    return out->pending();
+}
@@ -0,0 +1,145 @@
+#include "timer_wheel.hpp"
+#include <ctime>
+
+static const uint64_t SLOT_MASK = TimerWheel::SLOTS - 1;
+static const uint64_t MAX_DELTA = (1ull << (TimerWheel::SLOT_BITS * TimerWheel::LEVELS)) - 1;
+
+static bool empty(const TimerNode &head)
+{
+    return head.next == &head;
+}
+
+// moves every node of from to the front of to, from is left empty
+static void splice(TimerNode &from, TimerNode &to)
+{
+    if (empty(from))
+        return;
+    from.next->prev = &to;
+    from.prev->next = to.next;
+    to.next->prev = from.prev;
+    to.next = from.next;
+    from.prev = from.next = &from;
+}
+
+TimerWheel::TimerWheel()
+{
+    for (auto &level : slots)
+    {
+        for (TimerNode &head : level)
+        {
+            head.prev = head.next = &head;
+        }
+    }
+    nowMs = clock();
+    current = nowMs / TICK_MS + 1;
+}
+
+TimerWheel::~TimerWheel()
+{
+    // owners may outlive the wheel, leave their nodes disarmed rather than dangling
+    for (auto &level : slots)
+    {
+        for (TimerNode &head : level)
+        {
+            while (!empty(head))
+            {
+                head.next->unlink();
+            }
+            head.prev = head.next = nullptr;
+        }
+    }
+}
+
+uint64_t TimerWheel::clock()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void TimerWheel::arm(TimerNode &node, uint64_t timeoutMs)
+{
+    if (node.armed())
+        node.unlink();
+    else
+        count++;
+
+    // rounded up, a timer never fires before its deadline
+    node.expires = (nowMs + timeoutMs + TICK_MS - 1) / TICK_MS;
+    place(node);
+}
+
+void TimerWheel::cancel(TimerNode &node)
+{
+    if (!node.armed())
+        return;
+    node.unlink();
+    count--;
+}
+
+// Links node into the lowest level whose span still reaches its expiry,
+// indexed by the expiry bits of that level.
+void TimerWheel::place(TimerNode &node)
+{
+    if (node.expires < current)
+        node.expires = current;
+    uint64_t delta = node.expires - current;
+    if (delta > MAX_DELTA)
+    {
+        node.expires = current + MAX_DELTA;
+        delta = MAX_DELTA;
+    }
+
+    int level = 0;
+    while (level < LEVELS - 1 && delta >> (SLOT_BITS * (level + 1)))
+        level++;
+
+    TimerNode &head = slots[level][(node.expires >> (SLOT_BITS * level)) & SLOT_MASK];
+    node.prev = &head;
+    node.next = head.next;
+    head.next->prev = &node;
+    head.next = &node;
+}
+
+// Processes tick current: whenever a level wraps, the next slot of the level
+// above is redistributed first, then the due level 0 slot moves onto due.
+void TimerWheel::collect(TimerNode &due)
+{
+    if ((current & SLOT_MASK) == 0)
+    {
+        for (int level = 1; level < LEVELS; level++)
+        {
+            uint64_t index = (current >> (SLOT_BITS * level)) & SLOT_MASK;
+            TimerNode pending;
+            pending.prev = pending.next = &pending;
+            splice(slots[level][index], pending);
+            while (!empty(pending))
+            {
+                TimerNode *node = pending.next;
+                node->unlink();
+                place(*node);
+            }
+            pending.unlink();
+
+            if (index != 0)
+                break;
+        }
+    }
+
+    splice(slots[0][current & SLOT_MASK], due);
+    current++;
+}
+
+int TimerWheel::timeoutMs() const
+{
+    if (count == 0)
+        return -1;
+
+    // the next tick with a due slot, or where level 0 wraps and the levels above cascade
+    uint64_t tick = current;
+    while ((tick & SLOT_MASK) != 0 && empty(slots[0][tick & SLOT_MASK]))
+        tick++;
+
+    uint64_t at = tick * TICK_MS;
+    return at > nowMs ? (int)(at - nowMs) : 0;
+}
@@ -0,0 +1,232 @@
+#include "upgrade.hpp"
+#include "logger.hpp"
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <climits>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+extern char **environ;
+
+static const char CHANNEL_ENV[] = "SERVER_UPGRADE_FD"; // fd of the socketpair end the new binary inherits
+static const size_t MAX_FDS = 253;                    // SCM_MAX_FD, what one message can carry
+static const char READY = 'R';
+
+static int channel = -1; // to the process we replace, open until ready()
+static int signalPipe[2] = {-1, -1};
+
+std::vector<int> upgrade::inherit()
+{
+    std::vector<int> fds;
+    const char *value = getenv(CHANNEL_ENV);
+    if (!value)
+        return fds;
+
+    // a later upgrade of this process passes its own channel
+    channel = atoi(value);
+    unsetenv(CHANNEL_ENV);
+    fcntl(channel, F_SETFD, FD_CLOEXEC);
+
+    uint32_t count = 0;
+    iovec iov{&count, sizeof(count)};
+    alignas(cmsghdr) char control[CMSG_SPACE(MAX_FDS * sizeof(int))];
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t received;
+    do
+        received = recvmsg(channel, &msg, MSG_CMSG_CLOEXEC);
+    while (received < 0 && errno == EINTR);
+
+    for (cmsghdr *header = CMSG_FIRSTHDR(&msg); received > 0 && header; header = CMSG_NXTHDR(&msg, header))
+    {
+        if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
+            continue;
+        size_t n = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        size_t start = fds.size();
+        fds.resize(start + n);
+        memcpy(fds.data() + start, CMSG_DATA(header), n * sizeof(int));
+    }
+
+    if (received != (ssize_t)sizeof(count) || fds.size() != count || (msg.msg_flags & MSG_CTRUNC))
+    {
+        logger.fatal("Failed to receive the listeners of the process being replaced");
+        exit(1);
+    }
+    logger.info("Inherited " + std::to_string(count) + " listening sockets from the process being replaced");
+    return fds;
+}
+
+void upgrade::ready()
+{
+    if (channel < 0)
+        return;
+    char byte = READY;
+    ssize_t ignored = write(channel, &byte, 1);
+    (void)ignored;
+    close(channel);
+    channel = -1;
+}
+
+static void onSignal(int)
+{
+    int saved = errno;
+    char byte = 1;
+    ssize_t ignored = write(signalPipe[1], &byte, 1);
+    (void)ignored;
+    errno = saved;
+}
+
+void upgrade::watchSignal()
+{
+    if (pipe2(signalPipe, O_CLOEXEC) < 0)
+    {
+        logger.fatal("Failed to create the upgrade signal pipe");
+        exit(1);
+    }
+    // a burst of signals must never block the handler
+    fcntl(signalPipe[1], F_SETFL, O_NONBLOCK);
+
+    struct sigaction action{};
+    action.sa_handler = onSignal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR2, &action, nullptr);
+}
+
+void upgrade::requested()
+{
+    char byte;
+    while (read(signalPipe[0], &byte, 1) < 0 && errno == EINTR)
+    {
+    }
+}
+
+// the binary on disk, which a deploy has replaced by renaming the new build over it
+static std::string executable()
+{
+    char path[PATH_MAX];
+    ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (length <= 0)
+        return "";
+
+    std::string result(path, length);
+    const std::string deleted = " (deleted)";
+    if (result.size() > deleted.size() && result.compare(result.size() - deleted.size(), deleted.size(), deleted) == 0)
+        result.erase(result.size() - deleted.size());
+    return result;
+}
+
+static std::vector<std::string> arguments()
+{
+    std::ifstream cmdline("/proc/self/cmdline", std::ios::binary);
+    std::vector<std::string> args;
+    std::string arg;
+    while (std::getline(cmdline, arg, '\0'))
+    {
+        args.push_back(arg);
+    }
+    return args;
+}
+
+bool upgrade::handOff(const std::vector<int> &listeners, int timeoutSeconds)
+{
+    std::string path = executable();
+    std::vector<std::string> args = arguments();
+    if (listeners.empty() || listeners.size() > MAX_FDS || path.empty() || args.empty())
+    {
+        logger.error("Cannot hand over " + std::to_string(listeners.size()) + " listeners to '" + path + "'");
+        return false;
+    }
+
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0)
+    {
+        logger.error("Failed to create the upgrade channel");
+        return false;
+    }
+
+    // everything the child needs is built before fork(), it only makes async-signal-safe calls
+    std::string channelVariable = std::string(CHANNEL_ENV) + "=" + std::to_string(pair[1]);
+    std::vector<char *> argv;
+    for (std::string &arg : args)
+    {
+        argv.push_back(arg.data());
+    }
+    argv.push_back(nullptr);
+    std::vector<char *> envp;
+    for (char **variable = environ; *variable; variable++)
+    {
+        if (strncmp(*variable, CHANNEL_ENV, sizeof(CHANNEL_ENV) - 1) != 0)
+            envp.push_back(*variable);
+    }
+    envp.push_back(channelVariable.data());
+    envp.push_back(nullptr);
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        logger.error("Failed to fork the new binary");
+        close(pair[0]);
+        close(pair[1]);
+        return false;
+    }
+    if (pid == 0)
+    {
+        // the only descriptor that survives the exec, the listeners come over it
+        fcntl(pair[1], F_SETFD, 0);
+        execve(path.c_str(), argv.data(), envp.data());
+        _exit(127);
+    }
+    close(pair[1]);
+
+    uint32_t count = listeners.size();
+    iovec iov{&count, sizeof(count)};
+    alignas(cmsghdr) char control[CMSG_SPACE(MAX_FDS * sizeof(int))]{};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(count * sizeof(int));
+    cmsghdr *header = CMSG_FIRSTHDR(&msg);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(count * sizeof(int));
+    memcpy(CMSG_DATA(header), listeners.data(), count * sizeof(int));
+
+    bool ok = sendmsg(pair[0], &msg, MSG_NOSIGNAL) == (ssize_t)sizeof(count);
+
+    // the new process writes one byte once it accepts, or exits and we read EOF
+    if (ok)
+    {
+        pollfd waitFor{pair[0], POLLIN, 0};
+        int polled;
+        do
+            polled = poll(&waitFor, 1, timeoutSeconds * 1000);
+        while (polled < 0 && errno == EINTR);
+
+        char byte = 0;
+        ok = polled == 1 && read(pair[0], &byte, 1) == 1 && byte == READY;
+    }
+    close(pair[0]);
+
+    if (!ok)
+    {
+        logger.error("New binary '" + path + "' did not come up, still serving from this process");
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+        return false;
+    }
+    logger.info("Handed " + std::to_string(count) + " listening sockets to pid " + std::to_string(pid));
+    return true;
+}
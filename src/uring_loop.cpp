@@ -0,0 +1,696 @@
+#include "uring_loop.hpp"
+#include "server.hpp"
+#include "logger.hpp"
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+
+static const unsigned RING_ENTRIES = 4096;
+static const unsigned RECV_BUFFERS = 256; // must be a power of two
+static const unsigned RECV_BUFFER_SIZE = 16384;
+static const uint16_t RECV_GROUP = 0;
+static const size_t SPLICE_CHUNK = 65536; // default pipe capacity
+
+// what a completion belongs to, packed into the low bits of user_data
+enum UringOp : uint64_t
+{
+    OP_ACCEPT = 1,
+    OP_RECV,
+    OP_SEND,
+    OP_SHUTDOWN,
+    OP_CLOSE,
+    OP_TICK,
+    OP_SPLICE_IN,
+    OP_SPLICE_OUT,
+    OP_OFFLOAD,
+    OP_CANCEL
+};
+
+static uint64_t encode(uint64_t id, UringOp op)
+{
+    return (id << 4) | op;
+}
+
+UringLoop::UringLoop(Server *server) : server(server) {}
+
+UringLoop::~UringLoop()
+{
+    for (auto &it : connections)
+    {
+        close(it.second->conn.fd);
+    }
+    if (bufRing)
+        munmap(bufRing, bufRingSize);
+    delete[] bufMemory;
+    if (sqes)
+        munmap(sqes, sqesSize);
+    if (sqRing)
+        munmap(sqRing, std::max(sqRingSize, cqRingSize));
+    if (ringfd >= 0)
+        close(ringfd);
+}
+
+bool UringLoop::init()
+{
+    io_uring_params params{};
+    ringfd = syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+    if (ringfd < 0)
+        return false;
+
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+        return false;
+
+    // ---- Map the rings, SQ and CQ share one mapping
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    sqRing = mmap(nullptr, std::max(sqRingSize, cqRingSize), PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED)
+    {
+        sqRing = nullptr;
+        return false;
+    }
+    cqRing = sqRing;
+
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = (io_uring_sqe *)mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        sqes = nullptr;
+        return false;
+    }
+
+    char *sq = (char *)sqRing;
+    sqHead = (unsigned *)(sq + params.sq_off.head);
+    sqTail = (unsigned *)(sq + params.sq_off.tail);
+    sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    sqEntries = *(unsigned *)(sq + params.sq_off.ring_entries);
+    sqArray = (unsigned *)(sq + params.sq_off.array);
+
+    char *cq = (char *)cqRing;
+    cqHead = (unsigned *)(cq + params.cq_off.head);
+    cqTail = (unsigned *)(cq + params.cq_off.tail);
+    cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    // ---- Provided buffer ring for multishot recv
+    bufCount = RECV_BUFFERS;
+    bufSize = RECV_BUFFER_SIZE;
+    bufRingSize = bufCount * sizeof(io_uring_buf);
+    void *ring = mmap(nullptr, bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED)
+        return false;
+    bufRing = (io_uring_buf_ring *)ring;
+
+    io_uring_buf_reg reg{};
+    reg.ring_addr = (uint64_t)bufRing;
+    reg.ring_entries = bufCount;
+    reg.bgid = RECV_GROUP;
+    if (syscall(__NR_io_uring_register, ringfd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        return false; // kernel older than 5.19
+
+    bufMemory = new char[(size_t)bufCount * bufSize];
+    for (unsigned bid = 0; bid < bufCount; bid++)
+    {
+        recycleBuffer(bid);
+    }
+
+    tick.tv_nsec = 0;
+    return true;
+}
+
+void UringLoop::listenOn(int fd)
+{
+    listenfds.push_back(fd);
+}
+
+void UringLoop::wake()
+{
+    uint64_t one = 1;
+    ssize_t ignored = write(mailbox.fd, &one, sizeof(one));
+    (void)ignored;
+}
+
+io_uring_sqe *UringLoop::getSqe()
+{
+    unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    unsigned tail = *sqTail;
+
+    // Ring full, hand what we have to the kernel first. It may take only part
+    // of it (EBUSY, EINTR), and the slot at tail is then still an unsubmitted
+    // entry, so wait for completions until it really has room.
+    while (tail - head >= sqEntries)
+    {
+        if (!submitAndWait(1))
+        {
+            logger.fatal("io_uring submission queue is stuck");
+            exit(1);
+        }
+        head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    }
+
+    unsigned index = tail & sqMask;
+    io_uring_sqe *sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray[index] = index;
+
+    // the kernel only reads the entry on io_uring_enter, so it is filled in after publishing
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    pendingSubmissions++;
+    return sqe;
+}
+
+bool UringLoop::submitAndWait(unsigned waitFor)
+{
+    unsigned flags = waitFor ? IORING_ENTER_GETEVENTS : 0;
+    int ret = syscall(__NR_io_uring_enter, ringfd, pendingSubmissions, waitFor, flags, nullptr, 0);
+    if (ret >= 0)
+        pendingSubmissions -= std::min<unsigned>(ret, pendingSubmissions);
+    else if (errno != EINTR && errno != EBUSY && errno != EAGAIN)
+    {
+        logger.error("io_uring_enter failed");
+        return false;
+    }
+    return true;
+}
+
+void UringLoop::recycleBuffer(unsigned bid)
+{
+    // the tail aliases bufs[0].resv, so only the payload fields are written. The
+    // entries are indexed by hand: in C++ the header's flexible array member picks
+    // up the padding of an empty struct and lands on the wrong offset.
+    io_uring_buf *bufs = (io_uring_buf *)bufRing;
+    unsigned short tail = bufs[0].resv;
+    io_uring_buf *buf = &bufs[tail & (bufCount - 1)];
+    buf->addr = (uint64_t)(bufMemory + (size_t)bid * bufSize);
+    buf->len = bufSize;
+    buf->bid = bid;
+    __atomic_store_n(&bufs[0].resv, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}
+
+void UringLoop::armAccept(size_t listener)
+{
+    io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenfds[listener];
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = encode(listener, OP_ACCEPT);
+}
+
+void UringLoop::armRecv(UringConnection &uc)
+{
+    io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = uc.conn.fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RECV_GROUP;
+    sqe->user_data = encode(uc.id, OP_RECV);
+    uc.recvArmed = true;
+}
+
+// A peer that pipelines without reading the responses would otherwise grow the
+// read buffer for as long as it keeps sending. Past the most one request may
+// take the recv is cancelled and TCP pushes back on the peer instead, like
+// EventLoop::onReadable leaving the socket unread.
+void UringLoop::pauseRecv(UringConnection &uc)
+{
+    uc.recvPaused = true;
+    if (!uc.recvArmed)
+        return;
+    io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = encode(uc.id, OP_RECV);
+    sqe->user_data = encode(0, OP_CANCEL);
+}
+
+void UringLoop::resumeRecv(UringConnection &uc)
+{
+    size_t limit = server->REQUEST_HEADER_SIZE_LIMIT + server->REQUEST_BODY_SIZE_LIMIT;
+    if (!uc.recvPaused || uc.closing || uc.conn.readBuffer.size() >= limit)
+        return;
+    uc.recvPaused = false;
+    // a recv still winding down from the cancel re-arms from its last completion
+    if (!uc.recvArmed)
+        armRecv(uc);
+}
+
+void UringLoop::armTick()
+{
+    // also completes with the next CQE, so timers armed meanwhile never wait
+    // past a stale tick; every deadline is at least a second out
+    int ms = timers.timeoutMs();
+    if (ms < 0 || ms > 1000)
+        ms = 1000;
+    tick.tv_sec = ms / 1000;
+    tick.tv_nsec = (long long)(ms % 1000) * 1000000;
+
+    io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->addr = (uint64_t)&tick;
+    sqe->len = 1;
+    sqe->user_data = encode(0, OP_TICK);
+}
+
+void UringLoop::armMailbox()
+{
+    io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = mailbox.fd;
+    sqe->addr = (uint64_t)&mailboxCount;
+    sqe->len = sizeof(mailboxCount);
+    sqe->user_data = encode(0, OP_OFFLOAD);
+}
+
+void UringLoop::submitSend(UringConnection &uc)
+{
+    Connection &conn = uc.conn;
+    OutputQueue &out = conn.output;
+
+    if (out.chunks.front().isFile())
+    {
+        submitSplice(uc);
+        return;
+    }
+
+    // every queued memory chunk in one sendmsg, cached assets are never copied
+    uc.msg = msghdr{};
+    uc.msg.msg_iov = uc.iov;
+    uc.msg.msg_iovlen = out.gather(uc.iov, OutputQueue::MAX_IOV);
+
+    io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = conn.fd;
+    sqe->addr = (uint64_t)&uc.msg;
+    sqe->len = 1;
+    // MSG_WAITALL makes the kernel retry short sends, so the link below only breaks on errors.
+    // MSG_MORE lets headers share a segment with the file data queued behind them
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL | (uc.msg.msg_iovlen < out.chunks.size() ? MSG_MORE : 0);
+    sqe->user_data = encode(uc.id, OP_SEND);
+    uc.sending = true;
+
+    if (conn.closeAfterWrite && !conn.stream && uc.msg.msg_iovlen == out.chunks.size())
+    {
+        sqe->flags |= IOSQE_IO_LINK;
+        submitClose(uc);
+    }
+}
+
+// Moves the next piece of the front file chunk through the connection's pipe,
+// the file pages never get copied into userspace.
+void UringLoop::submitSplice(UringConnection &uc)
+{
+    OutputChunk &chunk = uc.conn.output.chunks.front();
+
+    if (uc.pipe[0] < 0 && pipe2(uc.pipe, O_CLOEXEC) < 0)
+    {
+        logger.error("Failed to create splice pipe");
+        submitClose(uc);
+        return;
+    }
+
+    io_uring_sqe *sqe;
+    if (uc.pipeBytes == 0)
+    {
+        uc.pipeBytes = std::min(chunk.fileRemaining, SPLICE_CHUNK);
+
+        sqe = getSqe();
+        sqe->opcode = IORING_OP_SPLICE;
+        sqe->splice_fd_in = chunk.fileFd;
+        sqe->splice_off_in = chunk.fileOffset;
+        sqe->fd = uc.pipe[1];
+        sqe->off = (uint64_t)-1;
+        sqe->len = uc.pipeBytes;
+        // a short splice in breaks the link, the out side is cancelled and resubmitted
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = encode(uc.id, OP_SPLICE_IN);
+
+        chunk.fileOffset += uc.pipeBytes;
+        chunk.fileRemaining -= uc.pipeBytes;
+    }
+
+    sqe = getSqe();
+    sqe->opcode = IORING_OP_SPLICE;
+    sqe->splice_fd_in = uc.pipe[0];
+    sqe->splice_off_in = (uint64_t)-1;
+    sqe->fd = uc.conn.fd;
+    sqe->off = (uint64_t)-1;
+    sqe->len = uc.pipeBytes;
+    sqe->user_data = encode(uc.id, OP_SPLICE_OUT);
+    uc.sending = true;
+}
+
+void UringLoop::submitClose(UringConnection &uc)
+{
+    // shutdown first so the armed multishot recv terminates, then release the fd.
+    // hard linked, the close has to run even when the peer is already gone
+    io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_SHUTDOWN;
+    sqe->fd = uc.conn.fd;
+    sqe->len = SHUT_RDWR;
+    sqe->flags = IOSQE_IO_HARDLINK;
+    sqe->user_data = encode(uc.id, OP_SHUTDOWN);
+
+    sqe = getSqe();
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = uc.conn.fd;
+    sqe->user_data = encode(uc.id, OP_CLOSE);
+    uc.closing = true;
+}
+
+void UringLoop::run()
+{
+    for (size_t i = 0; i < listenfds.size(); i++)
+    {
+        armAccept(i);
+    }
+    armTick();
+    // also how wake() gets through
+    armMailbox();
+    if (server->offloading)
+        server->scheduler.attach();
+
+    while (true)
+    {
+        submitAndWait(1);
+
+        // expire what came due while waiting, and give the handlers below a fresh clock to arm from
+        timers.advance([this](TimerNode &node) { onTimeout(*(UringConnection *)node.owner); });
+
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        while (head != tail)
+        {
+            io_uring_cqe cqe = cqes[head & cqMask];
+            head++;
+            // release the slot before handling, handlers may queue more work
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+
+            UringOp op = (UringOp)(cqe.user_data & 0xf);
+            uint64_t id = cqe.user_data >> 4;
+
+            if (op == OP_ACCEPT)
+            {
+                onAccept(id, cqe.res, cqe.flags);
+                continue;
+            }
+            if (op == OP_CANCEL)
+                continue;
+            if (op == OP_TICK)
+            {
+                armTick();
+                continue;
+            }
+            if (op == OP_OFFLOAD)
+            {
+                onOffloaded();
+                armMailbox();
+                if (server->draining && !draining)
+                    drain();
+                continue;
+            }
+
+            auto it = connections.find(id);
+            if (it == connections.end())
+            {
+                // late completion for a connection that is already gone
+                if (cqe.flags & IORING_CQE_F_BUFFER)
+                    recycleBuffer(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+                continue;
+            }
+            UringConnection &uc = *it->second;
+            // bytes from a peer that isn't reading its responses don't make it any less idle
+            bool stalled = op == OP_RECV && uc.sending;
+
+            if (op == OP_RECV)
+                onRecv(uc, cqe.res, cqe.flags);
+            else if (op == OP_SEND)
+                onSend(uc, cqe.res);
+            else if (op == OP_SPLICE_IN)
+                onSpliceIn(uc, cqe.res);
+            else if (op == OP_SPLICE_OUT)
+                onSpliceOut(uc, cqe.res);
+            else if (op == OP_CLOSE)
+            {
+                if (cqe.res == -ECANCELED)
+                {
+                    // the linked send failed, close without it
+                    uc.sending = false;
+                    submitClose(uc);
+                    continue;
+                }
+                logger.debug("Closing the Connection for IP: " + uc.conn.ip);
+                timers.cancel(uc.conn.timer);
+                connections.erase(it);
+                server->metrics.connectionClosed();
+                if (draining)
+                    checkDrained();
+                continue;
+            }
+
+            if (uc.closing)
+                timers.cancel(uc.conn.timer);
+            else if (!(stalled && uc.sending && uc.conn.timer.armed()))
+                armDeadline(server, timers, uc.conn);
+        }
+    }
+}
+
+void UringLoop::onAccept(size_t listener, int res, uint32_t flags)
+{
+    // multishot accept stays armed until the kernel says otherwise, or we cancelled it
+    if (!(flags & IORING_CQE_F_MORE) && !draining)
+        armAccept(listener);
+
+    if (res < 0)
+    {
+        if (res != -ECANCELED)
+            logger.error("Failed to accept connection");
+        return;
+    }
+
+    auto uc = std::make_unique<UringConnection>();
+    uc->id = nextId++;
+    uc->conn.fd = res;
+    uc->conn.id = uc->id;
+    uc->conn.mailbox = &mailbox;
+    uc->conn.timer.owner = uc.get();
+    uc->conn.ip = peerAddress(res, uc->conn.peer);
+
+    armRecv(*uc);
+    armDeadline(server, timers, uc->conn);
+    connections[uc->id] = std::move(uc);
+    server->metrics.connectionOpened();
+}
+
+void UringLoop::onRecv(UringConnection &uc, int res, uint32_t flags)
+{
+    Connection &conn = uc.conn;
+    bool rearm = !(flags & IORING_CQE_F_MORE);
+    if (rearm)
+        uc.recvArmed = false;
+
+    if (flags & IORING_CQE_F_BUFFER)
+    {
+        unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        if (res > 0)
+        {
+            conn.readBuffer.append(bufMemory + (size_t)bid * bufSize, res);
+            if (server->METRICS)
+                conn.receivedAt = Metrics::now();
+        }
+        recycleBuffer(bid);
+    }
+
+    // ENOBUFS: every provided buffer was in use, they are back in the ring now.
+    // ECANCELED: pauseRecv, unless it was resumed meanwhile.
+    if (res == -ENOBUFS || res == -ECANCELED)
+    {
+        if (rearm && !uc.closing && !uc.recvPaused)
+            armRecv(uc);
+        return;
+    }
+
+    if (res <= 0)
+    {
+        conn.peerClosed = true;
+        if (!uc.sending && !uc.closing && !conn.offloaded)
+            submitClose(uc);
+        return;
+    }
+
+    size_t limit = server->REQUEST_HEADER_SIZE_LIMIT + server->REQUEST_BODY_SIZE_LIMIT;
+    if (conn.readBuffer.size() >= limit && !uc.recvPaused)
+        pauseRecv(uc);
+    if (rearm && !uc.closing && !uc.recvPaused)
+        armRecv(uc);
+
+    processRequests(uc);
+}
+
+void UringLoop::onSend(UringConnection &uc, int res)
+{
+    Connection &conn = uc.conn;
+    uc.sending = false;
+
+    if (res < 0)
+    {
+        // a linked close is cancelled and resubmitted from its own completion
+        if (!uc.closing)
+            submitClose(uc);
+        return;
+    }
+
+    conn.output.consume(res);
+    afterSend(uc);
+}
+
+void UringLoop::onSpliceIn(UringConnection &uc, int res)
+{
+    // submitSplice assumed the whole piece would make it into the pipe
+    size_t expected = uc.pipeBytes;
+    if (res <= 0)
+    {
+        // 0 means the file shrank under us, the announced length can't be honoured
+        uc.spliceFailed = true;
+        return;
+    }
+
+    OutputChunk &chunk = uc.conn.output.chunks.front();
+    chunk.fileOffset -= expected - res;
+    chunk.fileRemaining += expected - res;
+    uc.pipeBytes = res;
+}
+
+void UringLoop::onSpliceOut(UringConnection &uc, int res)
+{
+    Connection &conn = uc.conn;
+    uc.sending = false;
+
+    if (uc.spliceFailed || (res < 0 && res != -ECANCELED))
+    {
+        if (!uc.closing)
+            submitClose(uc);
+        return;
+    }
+
+    if (res > 0)
+        uc.pipeBytes -= res;
+
+    OutputQueue &out = conn.output;
+    if (uc.pipeBytes == 0 && out.chunks.front().fileRemaining == 0)
+        out.popFront();
+    afterSend(uc);
+}
+
+// Keeps draining the output queue, then goes back to the read buffer once the
+// kernel holds everything.
+void UringLoop::afterSend(UringConnection &uc)
+{
+    if (uc.closing)
+        return;
+    if (uc.conn.stream && uc.conn.output.pending() < STREAM_WATERMARK)
+        pumpStream(uc.conn);
+    if (!uc.conn.output.empty())
+    {
+        submitSend(uc);
+        return;
+    }
+    processRequests(uc);
+}
+
+void UringLoop::processRequests(UringConnection &uc)
+{
+    Connection &conn = uc.conn;
+
+    // the front output chunk is owned by the kernel while a send is in flight
+    if (uc.closing || uc.sending)
+        return;
+
+    // every pipelined request of the batch goes out in one sendmsg, the rest after it completes
+    int served = 0;
+    while (served < PIPELINE_BATCH && !conn.closeAfterWrite && !conn.busy() && serveNext(server, conn))
+        served++;
+
+    if (!conn.output.empty())
+        submitSend(uc);
+    else if ((conn.peerClosed || conn.closeAfterWrite) && !conn.offloaded)
+        submitClose(uc);
+    else
+        resumeRecv(uc);
+}
+
+// The new process accepts from now on. The listeners stay open, it shares them,
+// only the accepts armed on them are cancelled.
+void UringLoop::drain()
+{
+    draining = true;
+    for (size_t i = 0; i < listenfds.size(); i++)
+    {
+        io_uring_sqe *sqe = getSqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = encode(i, OP_ACCEPT);
+        sqe->user_data = encode(0, OP_CANCEL);
+    }
+
+    for (auto &it : connections)
+    {
+        if (!it.second->closing)
+            armDeadline(server, timers, it.second->conn);
+    }
+    checkDrained();
+}
+
+void UringLoop::checkDrained()
+{
+    if (drained || !connections.empty())
+        return;
+    drained = true;
+    server->loopDrained();
+}
+
+void UringLoop::onOffloaded()
+{
+    for (auto &request : mailbox.take())
+    {
+        auto it = connections.find(request->connection);
+        if (it == connections.end() || it->second->closing)
+            continue; // closed while the handler ran
+        UringConnection &uc = *it->second;
+
+        // an in-flight send picks the response up when it completes
+        finishOffloaded(uc.conn, *request);
+        if (!uc.sending)
+            afterSend(uc);
+        if (!uc.closing)
+            armDeadline(server, timers, uc.conn);
+    }
+}
+
+void UringLoop::onTimeout(UringConnection &uc)
+{
+    if (uc.closing)
+        return;
+    logger.debug("Connection timed out for IP: " + uc.conn.ip);
+
+    // a send the peer stopped reading would stay in flight forever, failing it closes the connection
+    if (uc.sending)
+    {
+        shutdown(uc.conn.fd, SHUT_RDWR);
+        return;
+    }
+    if (!requestTimedOut(uc.conn))
+    {
+        submitClose(uc);
+        return;
+    }
+
+    // the 408 closes the connection once sent, a peer that never reads it hits the idle deadline
+    submitSend(uc);
+    armDeadline(server, timers, uc.conn);
+}